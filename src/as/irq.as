@@ -4,7 +4,6 @@
 		.global irq\arg1
 		.type irq\arg1, @function
 		irq\arg1:
-			cli
 			push $0
 			push $\arg2
 			jmp irq_common_stub
@@ -29,21 +28,35 @@
 	
 	.extern irq_handler
 	
+	# the interrupt gate already turned interrupts off, and iret puts the flags back the way they were,
+	# so there's no cli or sti in here.
 	.global irq_common_stub
 	.type irq_common_stub, @function
 	irq_common_stub:
 		pusha
 		
+		# memmove copies backward with the direction flag set, and the C code in
+		# the handlers expects it clear. iret puts the old one back.
+		cld
+		
 		mov %ds, %ax
 		push %eax
 		
+		# if the interrupt came in while the kernel was running, the segment registers
+		# are already the kernel's and don't need loading. the CS the processor pushed
+		# is 48 bytes up, past ds, pusha, the vector, the error code, and eip.
+		testl $3, 48(%esp)
+		jz irq_kernel_mode
+		
 		mov $0x10, %ax
 		mov %ax, %ds 
 		mov %ax, %es
 		mov %ax, %fs
 		mov %ax, %gs
 		
+		push %esp
 		call irq_handler
+		addl $4, %esp
 		
 		pop %ebx
 		mov %bx, %ds
@@ -53,5 +66,13 @@
 		
 		popa
 		addl $8, %esp
-		sti
+		iret
+		
+	irq_kernel_mode:
+		push %esp
+		call irq_handler
+		addl $8, %esp
+		
+		popa
+		addl $8, %esp
 		iret
@@ -65,6 +65,10 @@
 	isr_common_stub:
 		pusha
 		
+		# memmove copies backward with the direction flag set, and the C code in
+		# the handlers expects it clear. iret puts the old one back.
+		cld
+		
 		mov %ds, %ax
 		push %eax
 		
@@ -74,7 +78,10 @@
 		mov %ax, %fs
 		mov %ax, %gs
 		
+		# the handler gets a pointer to the registers that were just pushed
+		push %esp
 		call isr_handler
+		addl $4, %esp
 		
 		pop %ebx
 		mov %bx, %ds
@@ -84,5 +91,6 @@
 		
 		popa
 		addl $8, %esp
-		sti
+		
+		# no sti here. iret puts back whatever flags were in place when the exception hit.
 		iret
@@ -0,0 +1,25 @@
+.section .text
+
+	# switch_task(u32int *old_esp, u32int new_esp)
+	# the registers C expects to survive a call go on the old thread's stack, the stack
+	# pointer gets saved in *old_esp, and then the new thread picks up where it left off.
+	# the new thread's stack has to look the same, so a brand new one is set up that way.
+	.global switch_task
+	.type switch_task, @function
+	switch_task:
+		push %ebp
+		push %ebx
+		push %esi
+		push %edi
+		
+		mov 20(%esp), %eax
+		mov 24(%esp), %ecx
+		
+		mov %esp, (%eax)
+		mov %ecx, %esp
+		
+		pop %edi
+		pop %esi
+		pop %ebx
+		pop %ebp
+		ret
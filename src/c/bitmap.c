@@ -1,5 +1,12 @@
 #include <bitmap.h>
 
+static u32int word_count(bitmap_type *bitmap);
+static u32int word_mask(bitmap_type *bitmap, u32int word);
+static u32int read_word(bitmap_type *bitmap, u32int word);
+static void write_word(bitmap_type *bitmap, u32int word, u32int value);
+static void update_summary(bitmap_type *bitmap, u32int word);
+static u32int next_word(bitmap_type *bitmap, u32int word, boolean want_set);
+
 boolean test_bit(bitmap_type *bitmap, u32int bit)
 {
 	return (boolean) ((bitmap->addr[bit / 8] & (0x1 << (bit % 8))) != 0);
@@ -8,79 +15,314 @@ boolean test_bit(bitmap_type *bitmap, u32int bit)
 void set_bit(bitmap_type *bitmap, u32int bit)
 {
 	bitmap->addr[bit / 8] |= (0x1 << (bit % 8));
+	update_summary(bitmap, bit / 32);
 }
 
 void clear_bit(bitmap_type *bitmap, u32int bit)
 {
 	bitmap->addr[bit / 8] &= ~(0x1 << (bit % 8));
+	update_summary(bitmap, bit / 32);
 }
 
 u32int find_first_set_bit(bitmap_type *bitmap)
 {
-	for (u32int i = 0; i < bitmap->bytes; i++)
+	u32int result = next_set_from(bitmap, 0);
+	
+	if (result == 0xFFFFFFFF)
 	{
-		if (bitmap->addr[i] != 0x0)
-		{
-			for (u8int j = 0; j < 8; j++)
-			{
-				if ((bitmap->addr[i] & (0x1 << j)))
-				{
-					return ((i * 8) + j);
-				}
-			}
-		}
+		return 0;
 	}
-	return 0;
+	return result;
 }
 
 u32int find_first_clear_bit(bitmap_type *bitmap)
 {
-	for (u32int i = 0; i < bitmap->bytes; i++)
+	u32int result = next_clear_from(bitmap, 0);
+	
+	if (result == 0xFFFFFFFF)
 	{
-		if (bitmap->addr[i] != 0xFF)
-		{
-			for (u8int j = 0; j < 8; j++)
-			{
-				if (!(bitmap->addr[i] & (0x1 << j)))
-				{
-					return ((i * 8) + j);
-				}
-			}
-		}
+		return 0;
 	}
-	return 0;
+	return result;
 }
 
 void clear_all_bits(bitmap_type *bitmap)
 {
 	memset((u8int *) bitmap->addr, 0x0, bitmap->bytes);
+	
+	if (bitmap->full != NULL)
+	{
+		memset((u8int *) bitmap->full, 0x0, bitmap_summary_size(bitmap->bytes));
+		memset((u8int *) bitmap->empty, 0xFF, bitmap_summary_size(bitmap->bytes));
+	}
 }
 
 void set_all_bits(bitmap_type *bitmap)
 {
 	memset((u8int *) bitmap->addr, 0xFF, bitmap->bytes);
+	
+	if (bitmap->full != NULL)
+	{
+		memset((u8int *) bitmap->full, 0xFF, bitmap_summary_size(bitmap->bytes));
+		memset((u8int *) bitmap->empty, 0x0, bitmap_summary_size(bitmap->bytes));
+	}
 }
 
 boolean any_bit_clear(bitmap_type *bitmap)
 {
-	for (u32int i = 0; i < bitmap->bytes; i++)
+	return (boolean) (next_word(bitmap, 0, FALSE) != 0xFFFFFFFF);
+}
+
+boolean any_bit_set(bitmap_type *bitmap)
+{
+	return (boolean) (next_word(bitmap, 0, TRUE) != 0xFFFFFFFF);
+}
+
+u32int next_set_from(bitmap_type *bitmap, u32int bit)
+{
+	if ((bit / 8) >= bitmap->bytes)
+	{
+		return 0xFFFFFFFF;
+	}
+	
+	// look at what's left of the word the bit is on
+	u32int word = bit / 32;
+	u32int value = read_word(bitmap, word) & word_mask(bitmap, word) & (0xFFFFFFFF << (bit % 32));
+	
+	if (value == 0)
 	{
-		if (bitmap->addr[i] != 0xFF)
+		// find the next word with anything set on it
+		word = next_word(bitmap, word + 1, TRUE);
+		
+		if (word == 0xFFFFFFFF)
 		{
-			return TRUE;
+			return 0xFFFFFFFF;
 		}
+		
+		value = read_word(bitmap, word) & word_mask(bitmap, word);
 	}
-	return FALSE;
+	
+	return (word * 32) + __builtin_ctz(value);
 }
 
-boolean any_bit_set(bitmap_type *bitmap)
+u32int next_clear_from(bitmap_type *bitmap, u32int bit)
+{
+	if ((bit / 8) >= bitmap->bytes)
+	{
+		return 0xFFFFFFFF;
+	}
+	
+	// look at what's left of the word the bit is on
+	u32int word = bit / 32;
+	u32int value = ~read_word(bitmap, word) & word_mask(bitmap, word) & (0xFFFFFFFF << (bit % 32));
+	
+	if (value == 0)
+	{
+		// find the next word with anything clear on it
+		word = next_word(bitmap, word + 1, FALSE);
+		
+		if (word == 0xFFFFFFFF)
+		{
+			return 0xFFFFFFFF;
+		}
+		
+		value = ~read_word(bitmap, word) & word_mask(bitmap, word);
+	}
+	
+	return (word * 32) + __builtin_ctz(value);
+}
+
+void set_range(bitmap_type *bitmap, u32int bit, u32int count)
 {
-	for (u32int i = 0; i < bitmap->bytes; i++)
+	while (count > 0)
 	{
-		if (bitmap->addr[i] != 0x0)
+		// figure out how much of the range lands on this word
+		u32int word = bit / 32;
+		u32int offset = bit % 32;
+		u32int span = 32 - offset;
+		
+		if (span > count)
+		{
+			span = count;
+		}
+		
+		u32int mask = (span == 32) ? 0xFFFFFFFF : ((((u32int) 1 << span) - 1) << offset);
+		
+		write_word(bitmap, word, read_word(bitmap, word) | mask);
+		update_summary(bitmap, word);
+		
+		bit += span;
+		count -= span;
+	}
+}
+
+void clear_range(bitmap_type *bitmap, u32int bit, u32int count)
+{
+	while (count > 0)
+	{
+		// figure out how much of the range lands on this word
+		u32int word = bit / 32;
+		u32int offset = bit % 32;
+		u32int span = 32 - offset;
+		
+		if (span > count)
+		{
+			span = count;
+		}
+		
+		u32int mask = (span == 32) ? 0xFFFFFFFF : ((((u32int) 1 << span) - 1) << offset);
+		
+		write_word(bitmap, word, read_word(bitmap, word) & ~mask);
+		update_summary(bitmap, word);
+		
+		bit += span;
+		count -= span;
+	}
+}
+
+u32int bitmap_summary_size(u32int bytes)
+{
+	// one bit for each word on the bitmap, rounded up to whole words
+	u32int words = (bytes + 3) / 4;
+	return ((words + 31) / 32) * 4;
+}
+
+void attach_summary(bitmap_type *bitmap, u32int *full, u32int *empty)
+{
+	bitmap->full = full;
+	bitmap->empty = empty;
+	
+	// bring the summary up to date with whatever's already on the bitmap
+	for (u32int i = 0; i < word_count(bitmap); i++)
+	{
+		update_summary(bitmap, i);
+	}
+}
+
+static u32int word_count(bitmap_type *bitmap)
+{
+	return (bitmap->bytes + 3) / 4;
+}
+
+// the last word might not be a whole word, this figures out which of its bits are really on the bitmap
+static u32int word_mask(bitmap_type *bitmap, u32int word)
+{
+	u32int bytes_left = bitmap->bytes - (word * 4);
+	
+	if (bytes_left >= 4)
+	{
+		return 0xFFFFFFFF;
+	}
+	return ((u32int) 1 << (bytes_left * 8)) - 1;
+}
+
+static u32int read_word(bitmap_type *bitmap, u32int word)
+{
+	if ((word * 4) + 4 <= bitmap->bytes)
+	{
+		return ((u32int *) bitmap->addr)[word];
+	}
+	
+	// don't read past the end of the bitmap
+	u32int result = 0;
+	for (u32int i = word * 4; i < bitmap->bytes; i++)
+	{
+		result |= bitmap->addr[i] << ((i % 4) * 8);
+	}
+	return result;
+}
+
+static void write_word(bitmap_type *bitmap, u32int word, u32int value)
+{
+	if ((word * 4) + 4 <= bitmap->bytes)
+	{
+		((u32int *) bitmap->addr)[word] = value;
+		return;
+	}
+	
+	// don't write past the end of the bitmap
+	for (u32int i = word * 4; i < bitmap->bytes; i++)
+	{
+		bitmap->addr[i] = (value >> ((i % 4) * 8)) & 0xFF;
+	}
+}
+
+static void update_summary(bitmap_type *bitmap, u32int word)
+{
+	if (bitmap->full == NULL)
+	{
+		return;
+	}
+	
+	u32int mask = word_mask(bitmap, word);
+	u32int value = read_word(bitmap, word) & mask;
+	u32int summary_bit = (u32int) 1 << (word % 32);
+	
+	if (value == mask)
+	{
+		bitmap->full[word / 32] |= summary_bit;
+	}
+	else
+	{
+		bitmap->full[word / 32] &= ~summary_bit;
+	}
+	
+	if (value == 0)
+	{
+		bitmap->empty[word / 32] |= summary_bit;
+	}
+	else
+	{
+		bitmap->empty[word / 32] &= ~summary_bit;
+	}
+}
+
+// finds the first word at or after the one given that has a set bit on it (or a clear bit on it)
+static u32int next_word(bitmap_type *bitmap, u32int word, boolean want_set)
+{
+	u32int words = word_count(bitmap);
+	
+	// without a summary i have to look at every word
+	if (bitmap->full == NULL)
+	{
+		for (; word < words; word++)
+		{
+			u32int mask = word_mask(bitmap, word);
+			u32int value = read_word(bitmap, word) & mask;
+			
+			if ((want_set && (value != 0)) || (!want_set && (value != mask)))
+			{
+				return word;
+			}
+		}
+		return 0xFFFFFFFF;
+	}
+	
+	// with a summary i can skip 32 words at a time. the words i want are the
+	// ones that aren't marked empty (or aren't marked full)
+	u32int *summary = want_set ? bitmap->empty : bitmap->full;
+	u32int summary_words = (words + 31) / 32;
+	
+	for (u32int i = word / 32; i < summary_words; i++)
+	{
+		u32int candidates = ~summary[i];
+		
+		// skip the words before the one i started on
+		if (i == word / 32)
+		{
+			candidates &= 0xFFFFFFFF << (word % 32);
+		}
+		
+		// skip anything past the end of the bitmap
+		if ((i == summary_words - 1) && (words % 32 != 0))
+		{
+			candidates &= ((u32int) 1 << (words % 32)) - 1;
+		}
+		
+		if (candidates != 0)
 		{
-			return TRUE;
+			return (i * 32) + __builtin_ctz(candidates);
 		}
 	}
-	return FALSE;
+	return 0xFFFFFFFF;
 }
@@ -0,0 +1,129 @@
+#include <clock.h>
+
+// which counter clock_ns reads, and how to turn its count in to nanoseconds
+u32int clock_source_type = CLOCK_SOURCE_PIT;
+u32int clock_mult = CLOCK_PIT_MULT;
+u32int clock_shift = CLOCK_PIT_SHIFT;
+
+// the TSC when the clock was started, so clock_ns starts from 0 like the PIT count does
+u64int clock_tsc_base = 0;
+
+static u32int clock_calibrate_tsc();
+static u64int clock_scale(u64int value, u32int mult, u32int shift);
+
+void clock_initialize()
+{
+	/*
+	 * The TSC counts every cycle, so it's by far the best clock there is, but
+	 * nothing says how fast it goes. It gets timed against PIT channel 2, which
+	 * runs at a known rate, and from then on it's just a multiply and a shift
+	 * to turn it in to nanoseconds. The idle thread spends most of its time
+	 * halted, and on older processors the TSC slows down or stops while that
+	 * happens, so it's only used if the processor says it's invariant. If it
+	 * isn't, or it doesn't look right, the clock falls back to counting what
+	 * the PIT's been through.
+	 */
+	
+	if ((!cpu_has_feature(CPU_FEATURE_TSC)) || (!cpu_has_invariant_tsc()))
+	{
+		return;
+	}
+	
+	u32int cycles = clock_calibrate_tsc();
+	
+	if (cycles < CLOCK_TSC_MIN_CYCLES)
+	{
+		return;
+	}
+	
+	// how many nanoseconds the calibration took, and from that how many each cycle takes
+	u32int calibrate_ns = clock_div((u64int) CLOCK_CALIBRATE_COUNTS * 1000000000, PIT_FREQUENCY, NULL);
+	
+	clock_mult = clock_div((u64int) calibrate_ns << CLOCK_TSC_SHIFT, cycles, NULL);
+	clock_shift = CLOCK_TSC_SHIFT;
+	clock_tsc_base = cpu_read_tsc();
+	clock_source_type = CLOCK_SOURCE_TSC;
+}
+
+static u32int clock_calibrate_tsc()
+{
+	// nothing can interrupt this, or the count would come out too high
+	u32int eflags = interrupts_save();
+	
+	// turn channel 2's gate on, and keep the speaker it's wired to turned off
+	u8int port61 = inb(0x61);
+	outb(0x61, (port61 & ~(0x02)) | 0x01);
+	
+	// channel 2, low byte then high byte, mode 0 (output goes high on terminal count)
+	outb(0x43, 0xB0);
+	outb(0x42, (CLOCK_CALIBRATE_COUNTS & 0xFF));
+	outb(0x42, ((CLOCK_CALIBRATE_COUNTS >> 8) & 0xFF));
+	
+	// it starts counting as soon as it has the count, so see how many cycles go by until it's done
+	u64int start = cpu_read_tsc();
+	
+	while ((inb(0x61) & 0x20) == 0) {}
+	
+	u64int end = cpu_read_tsc();
+	
+	outb(0x61, port61);
+	
+	interrupts_restore(eflags);
+	
+	return (u32int) (end - start);
+}
+
+static u64int clock_scale(u64int value, u32int mult, u32int shift)
+{
+	// (value * mult) >> shift, done in two halves so the top of the product isn't lost
+	u64int low = ((u64int) (u32int) value * mult) >> shift;
+	u64int high = ((u64int) (u32int) (value >> 32) * mult) << (32 - shift);
+	
+	return high + low;
+}
+
+u64int clock_ns()
+{
+	if (clock_source_type == CLOCK_SOURCE_TSC)
+	{
+		return clock_scale(cpu_read_tsc() - clock_tsc_base, clock_mult, clock_shift);
+	}
+	
+	return clock_scale(timer_read_counts(), clock_mult, clock_shift);
+}
+
+u32int clock_source()
+{
+	return clock_source_type;
+}
+
+u32int clock_tsc_khz()
+{
+	if (clock_source_type != CLOCK_SOURCE_TSC)
+	{
+		return 0;
+	}
+	
+	// the mult is nanoseconds per cycle, so this turns it back around
+	return clock_div(1000000ULL << CLOCK_TSC_SHIFT, clock_mult, NULL);
+}
+
+u32int clock_div(u64int dividend, u32int divisor, u32int *remainder)
+{
+	// divl does a 64 bit by 32 bit divide, as long as the answer fits in 32 bits.
+	// there's no libgcc to do it otherwise.
+	u32int quotient, rest;
+	
+	asm (
+		"divl %4"
+		: "=a" (quotient), "=d" (rest)
+		: "a" ((u32int) dividend), "d" ((u32int) (dividend >> 32)), "rm" (divisor)
+	);
+	
+	if (remainder != NULL)
+	{
+		*remainder = rest;
+	}
+	
+	return quotient;
+}
@@ -0,0 +1,86 @@
+#include <cpu.h>
+
+// what cpuid leaf 1 said the processor can do
+u32int cpu_features = 0;
+
+// what cpuid leaf 0x80000007 said about power management
+u32int cpu_power_features = 0;
+
+void cpu_initialize()
+{
+	// a processor without cpuid doesn't have any of the features i care about
+	if (!cpu_has_cpuid())
+	{
+		return;
+	}
+	
+	u32int eax, ebx, ecx, edx;
+	
+	// make sure leaf 1 is there before asking for it
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	
+	if (eax < 1)
+	{
+		return;
+	}
+	
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	cpu_features = edx;
+	
+	// the extended leaves say whether the TSC can be used as a clock
+	cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+	
+	if (eax >= 0x80000007)
+	{
+		cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+		cpu_power_features = edx;
+	}
+}
+
+boolean cpu_has_cpuid()
+{
+	// if the ID bit on EFLAGS can be flipped, the processor has cpuid
+	u32int before, after;
+	
+	asm volatile (
+		"pushfl\n\t"
+		"pop %0\n\t"
+		"mov %0, %1\n\t"
+		"xor $0x200000, %1\n\t"
+		"push %1\n\t"
+		"popfl\n\t"
+		"pushfl\n\t"
+		"pop %1\n\t"
+		"push %0\n\t"
+		"popfl"
+		: "=&r" (before), "=&r" (after)
+	);
+	
+	return (boolean) (((before ^ after) & 0x200000) != 0);
+}
+
+void cpuid(u32int leaf, u32int *eax, u32int *ebx, u32int *ecx, u32int *edx)
+{
+	asm volatile (
+		"cpuid"
+		: "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+		: "a" (leaf), "c" (0)
+	);
+}
+
+boolean cpu_has_feature(u32int feature)
+{
+	return (boolean) ((cpu_features & feature) != 0);
+}
+
+boolean cpu_has_invariant_tsc()
+{
+	return (boolean) ((cpu_power_features & CPU_INVARIANT_TSC) != 0);
+}
+
+u64int cpu_read_tsc()
+{
+	u64int tsc;
+	asm volatile ("rdtsc" : "=A" (tsc));
+	return tsc;
+}
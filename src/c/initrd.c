@@ -40,7 +40,7 @@ void initrd_initialize(struct multiboot *mboot_ptr)
 	put_str("\nsizeof(u32int): ");
 	put_hex(sizeof(u32int));
 	
-	tar_headers = malloc(header_count * sizeof(u32int));
+	tar_headers = kmalloc(header_count * sizeof(u32int));
 	
 	put_str("\nAddress allocated for headers: ");
 	put_hex((u32int) tar_headers);
@@ -1,16 +1,22 @@
 #include <irq.h>
 
-void irq_handler(registers regs)
+void irq_handler(registers *regs)
 {
-	if (regs.int_no >= 20)
+	interrupt_count[regs->int_no]++;
+	
+	// IRQ 8 and up come through the slave PIC, and it needs telling too
+	if (regs->int_no >= IRQ8)
 	{
 		outb(0xA0, 0x20);
 	}
 	outb(0x20, 0x20);
 	
-	if (interrupt_handler[regs.int_no] != 0)
+	if (interrupt_handler[regs->int_no] != 0)
 	{
-		isr handler = interrupt_handler[regs.int_no];
+		isr handler = interrupt_handler[regs->int_no];
 		handler(regs);
 	}
+	
+	// the handler might have woken up a thread that's more important than the one it interrupted
+	task_preempt();
 }
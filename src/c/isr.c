@@ -1,15 +1,36 @@
 #include <isr.h>
 
+u32int interrupt_count[256];
+
 void register_interrupt_handler(u8int n, isr handler)
 {
 	interrupt_handler[n] = handler;
 }
 
-void isr_handler(registers regs)
+void isr_handler(registers *regs)
 {
-	if (interrupt_handler[regs.int_no] != 0)
+	interrupt_count[regs->int_no]++;
+	
+	if (interrupt_handler[regs->int_no] != 0)
 	{
-		isr handler = interrupt_handler[regs.int_no];
+		isr handler = interrupt_handler[regs->int_no];
 		handler(regs);
 	}
 }
+
+void interrupt_print_counts()
+{
+	// only the vectors that have actually gone off
+	for (u32int i = 0; i < 256; i++)
+	{
+		if (interrupt_count[i] != 0)
+		{
+			put_str("\nVector ");
+			put_dec(i);
+			put_str(": ");
+			put_dec(interrupt_count[i]);
+		}
+	}
+	
+	put_str("\n");
+}
@@ -19,6 +19,9 @@ int kernel_main(struct multiboot *mboot_ptr, u32int initial_stack)
 	
 	idt_initialize();
 	
+	// find out what the processor can do before paging gets set up
+	cpu_initialize();
+	
 	memset((u8int *) &interrupt_handler, 0, sizeof(isr) * 256);
 	
 	// this is where i need to initialize the physical memory manager
@@ -29,6 +32,12 @@ int kernel_main(struct multiboot *mboot_ptr, u32int initial_stack)
 	
 	vmm_initialize();
 	
+	kmem_initialize();
+	
+	kmalloc_initialize();
+	
+	pmm_pages_initialize();
+	
 	
 	
 	
@@ -49,6 +58,8 @@ int kernel_main(struct multiboot *mboot_ptr, u32int initial_stack)
 	
 	timer_initialize(100);
 	
+	clock_initialize();
+	
 	keyboard_initialize();
 	
 	keyboard_set_handler(kernel_keyboard_handler);
@@ -75,19 +86,40 @@ int kernel_main(struct multiboot *mboot_ptr, u32int initial_stack)
 	vga_buffer_put_str("Welcome to Patrick's Operating System!\n");
 	vga_buffer_put_char(terminal_seperator);
 	
+	// the terminal and the screen get threads of their own, and this one carries on as the idle thread
+	task_initialize();
+	
+	task_create("terminal", &terminal_thread, TASK_PRIORITY_DEFAULT);
+	task_create("vga", &vga_thread, TASK_PRIORITY_DEFAULT);
+	
 	for (;;)
 	{
-		// this is the main loop of the kernel
-		keyboard_flush();
-		
-		terminal();
+		// use the spare time to clear frames for the page fault handler, and sleep once they're all done
+		if (!pmm_zero_idle())
+		{
+			task_halt();
+		}
 		
-		vga_flush();
+		// if sleeping woke somebody up, let them have the processor
+		task_yield();
 	}
 	
 	return 0;
 }
 
+void terminal_thread()
+{
+	// this used to be the main loop of the kernel. now it sleeps until a key gets pressed.
+	for (;;)
+	{
+		keyboard_wait();
+		
+		keyboard_flush();
+		
+		terminal();
+	}
+}
+
 /*
  * This works, but will eventually need to be updated, and expanded.
  * I shouldn't be using a giant if/else if/else to decide what to do.
@@ -163,6 +195,13 @@ void terminal()
 				put_hex(input_addr);
 				put_str(" = Physical ");
 				put_hex(virt);
+				
+				extern u32int paging_xlate_hits;
+				extern u32int paging_xlate_misses;
+				put_str("\nTranslation cache hits: ");
+				put_dec(paging_xlate_hits);
+				put_str(" misses: ");
+				put_dec(paging_xlate_misses);
 				put_str("\n");
 			}
 			else if (strcmp((string) token, "readFault") == 0)
@@ -212,13 +251,135 @@ void terminal()
 			{
 				vmm_print_free();
 			}
+			else if (strcmp((string) token, "meminfo") == 0)
+			{
+				pmm_stats_type stats;
+				pmm_stats(&stats);
+				
+				put_str("\nTotal frames: ");
+				put_dec(stats.total_frames);
+				put_str(" (");
+				put_dec(stats.total_frames * 4);
+				put_str(" KB)");
+				
+				put_str("\nFree frames: ");
+				put_dec(stats.free_frames);
+				put_str(" (");
+				put_dec(stats.free_frames * 4);
+				put_str(" KB)");
+				
+				put_str("\nReserved frames: ");
+				put_dec(stats.reserved_frames);
+				
+				put_str("\nAllocated frames: ");
+				put_dec(stats.total_frames - stats.reserved_frames - stats.free_frames);
+				
+				put_str("\nPre-zeroed frames: ");
+				put_dec(stats.zeroed_frames);
+				
+				put_str("\nLargest free run: ");
+				put_dec(stats.largest_free_run);
+				put_str(" frames\n");
+			}
+			else if (strcmp((string) token, "faultDebug") == 0)
+			{
+				extern boolean paging_fault_debug;
+				paging_fault_debug = (boolean) !paging_fault_debug;
+				
+				put_str("\nPage fault debugging is ");
+				put_str(paging_fault_debug ? "on.\n" : "off.\n");
+			}
+			else if (strcmp((string) token, "faultAround") == 0)
+			{
+				extern u32int paging_fault_around_max;
+				u32int pages = str_to_u32int(&terminal_buffer[token_size + 1]);
+				
+				// with no number, or 0, a fault only maps the page that faulted
+				if (pages == 0)
+				{
+					pages = 1;
+				}
+				
+				paging_fault_around_max = pages;
+				
+				put_str("\nA page fault will map up to ");
+				put_dec(paging_fault_around_max);
+				put_str(" pages.\n");
+			}
+			else if (strcmp((string) token, "vmminfo") == 0)
+			{
+				vmm_node_stats_type stats;
+				vmm_node_stats(&stats);
+				
+				put_str("\nNodes in use: ");
+				put_dec(stats.nodes_created - stats.nodes_unused);
+				
+				put_str("\nNodes unused: ");
+				put_dec(stats.nodes_unused);
+				
+				put_str("\nNode arena high-water mark: ");
+				put_dec(stats.arena_used);
+				put_str(" of ");
+				put_dec(stats.arena_size);
+				put_str(" bytes (");
+				put_dec(stats.arena_mapped >> 12);
+				put_str(" pages mapped)\n");
+			}
+			else if (strcmp((string) token, "heapinfo") == 0)
+			{
+				kmalloc_print_stats();
+			}
+			else if (strcmp((string) token, "irqinfo") == 0)
+			{
+				interrupt_print_counts();
+			}
+			else if (strcmp((string) token, "tasks") == 0)
+			{
+				task_print_list();
+			}
+			else if (strcmp((string) token, "uptime") == 0)
+			{
+				u32int ns;
+				u32int seconds = clock_div(clock_ns(), 1000000000, &ns);
+				
+				put_str("\nUp ");
+				put_dec(seconds);
+				put_str(" seconds, ");
+				put_dec(ns / 1000000);
+				put_str(" ms (");
+				put_dec(get_tick());
+				put_str(" ticks)\n");
+			}
+			else if (strcmp((string) token, "clock") == 0)
+			{
+				put_str("\nClock source: ");
+				
+				if (clock_source() == CLOCK_SOURCE_TSC)
+				{
+					put_str("TSC at ");
+					put_dec(clock_tsc_khz());
+					put_str(" kHz");
+				}
+				else
+				{
+					put_str("PIT");
+				}
+				
+				// see how long it takes to read the clock, to get an idea how fine it is
+				u64int before = clock_ns();
+				u64int after = clock_ns();
+				
+				put_str("\nReading the clock takes ");
+				put_dec((u32int) (after - before));
+				put_str(" ns\n");
+			}
 			else if (strcmp((string) token, "mapTest") == 0)
 			{
 				put_str("\n");
 				
 				u32int phys_mem = alloc_frame();
 				
-				map_page(0xA0000000, phys_mem);
+				map_page(0xA0000000, phys_mem, PAGE_PRESENT | PAGE_WRITE);
 				
 				string *ptr = (string *) 0xA0000000;
 				
@@ -226,7 +387,7 @@ void terminal()
 				
 				unmap_page(0xA0000000);
 				
-				map_page(0xABCD0000, phys_mem);
+				map_page(0xABCD0000, phys_mem, PAGE_PRESENT | PAGE_WRITE);
 				
 				string *ptr2 = (string *) 0xABCD0000;
 				
@@ -240,6 +401,30 @@ void terminal()
 				
 				put_str("\n");
 			}
+			else if (strcmp((string) token, "cowTest") == 0)
+			{
+				extern page_directory_type *current_page_directory;
+				
+				u32int *ptr = (u32int *) 0x40000000;
+				
+				map_page((u32int) ptr, alloc_frame(), PAGE_PRESENT | PAGE_WRITE);
+				*ptr = 0x11111111;
+				
+				page_directory_type *original = current_page_directory;
+				page_directory_type *clone = clone_address_space();
+				
+				// writing in the clone should give it a copy, and leave the original alone
+				change_page_directory(clone);
+				*ptr = 0x22222222;
+				put_str("\nClone sees ");
+				put_hex(*ptr);
+				
+				change_page_directory(original);
+				put_str("\nOriginal sees ");
+				put_hex(*ptr);
+				
+				put_str("\n");
+			}
 			/*
 			else if (strcmp((string) token, "bitmap_test") == 0)
 			{
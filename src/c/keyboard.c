@@ -27,6 +27,9 @@ static u8int keyboard_buffer[KEYBOARD_BUFFER_SIZE];
 static u16int keyboard_buffer_length = 0; // buffer size is 4096 bytes, which can be expressed w/ 13 bits, so we can use a variable of 16 bits to keep track of the buffer size.
 static void (*keyboard_handler)(u8int *buf, u16int size) = NULL; // this is a function that lives in the kernel which actually takes care of what to do w/ the input i recieve
 
+// threads waiting for a key to be pressed
+static list_type keyboard_waiting;
+
 void keyboard_set_handler(void (*callback)(u8int *buf, u16int size))
 {
 	keyboard_handler = callback;
@@ -37,14 +40,28 @@ void keyboard_flush()
 {
 	if (keyboard_buffer_length > 0)
 	{
-		disable_interrupts();
+		// the interrupt handler calls this too when the buffer fills, so interrupts get put back how they were
+		u32int eflags = interrupts_save();
 		if (keyboard_handler != NULL)
 		{
 			keyboard_handler(keyboard_buffer, keyboard_buffer_length);
 		}
 		keyboard_buffer_length = 0;
-		enable_interrupts();
+		interrupts_restore(eflags);
+	}
+}
+
+void keyboard_wait()
+{
+	// blocks the thread until there's something on the buffer
+	u32int eflags = interrupts_save();
+	
+	if (keyboard_buffer_length == 0)
+	{
+		task_block(&keyboard_waiting);
 	}
+	
+	interrupts_restore(eflags);
 }
 
 void keyboard_initialize()
@@ -52,7 +69,7 @@ void keyboard_initialize()
 	register_interrupt_handler(IRQ1, (isr) &keyboard_interrupt_handler);
 }
 
-void keyboard_interrupt_handler(__attribute__ ((unused)) registers regs)
+void keyboard_interrupt_handler(__attribute__ ((unused)) registers *regs)
 {
 	u8int scancode;
 	
@@ -88,6 +105,8 @@ void keyboard_interrupt_handler(__attribute__ ((unused)) registers regs)
 		{
 			keyboard_flush();
 		}
+		
+		task_wake(&keyboard_waiting);
 	}
 }
 
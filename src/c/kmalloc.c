@@ -0,0 +1,241 @@
+#include <kmalloc.h>
+
+extern page_directory_type *current_page_directory;
+
+kmem_cache_type *kmalloc_caches[KMALLOC_CLASSES];
+kmalloc_stats_type kmalloc_stats;
+
+static u32int kmalloc_class(u32int size);
+static u32int *kmalloc_span(u32int size);
+static void kfree_span(u32int *ptr);
+static u32int kmalloc_usable_size(u32int *ptr);
+
+void kmalloc_initialize()
+{
+	for (u32int i = 0; i < KMALLOC_CLASSES; i++)
+	{
+		kmalloc_caches[i] = kmem_cache_create(1 << (KMALLOC_MIN_SHIFT + i), 1 << KMALLOC_MIN_SHIFT);
+		
+		if (kmalloc_caches[i] == NULL)
+		{
+			put_str("\nUnable to create the kmalloc cache for ");
+			put_dec(1 << (KMALLOC_MIN_SHIFT + i));
+			put_str(" byte objects.");
+			put_str("\nHalting.");
+			for (;;) {}
+		}
+		
+		kmalloc_stats.hits[i] = 0;
+		kmalloc_stats.misses[i] = 0;
+	}
+	
+	kmalloc_stats.span_allocs = 0;
+	kmalloc_stats.span_pages = 0;
+}
+
+u32int *kmalloc(u32int size)
+{
+	if (size == 0)
+	{
+		return NULL;
+	}
+	
+	if (size > KMALLOC_MAX_SMALL)
+	{
+		return kmalloc_span(size);
+	}
+	
+	u32int class = kmalloc_class(size);
+	kmem_cache_type *cache = kmalloc_caches[class];
+	
+	// it's a hit if there's already a slab with room on it, and a miss if the cache has to make a new one
+	if ((cache->partial.first != NULL) || (cache->empty.first != NULL))
+	{
+		kmalloc_stats.hits[class]++;
+	}
+	else
+	{
+		kmalloc_stats.misses[class]++;
+	}
+	
+	return kmem_cache_alloc(cache);
+}
+
+void kfree(u32int *ptr)
+{
+	if (ptr == NULL)
+	{
+		return;
+	}
+	
+	// spans always start on a page, and slab objects never do, because the slab header is there
+	if (((u32int) ptr & 0xFFF) == 0)
+	{
+		kfree_span(ptr);
+		return;
+	}
+	
+	kmem_slab_type *slab = (kmem_slab_type *) ((u32int) ptr & ~(KMEM_SLAB_SIZE - 1));
+	kmem_cache_free(slab->cache, ptr);
+}
+
+u32int *krealloc(u32int *ptr, u32int size)
+{
+	if (ptr == NULL)
+	{
+		return kmalloc(size);
+	}
+	
+	if (size == 0)
+	{
+		kfree(ptr);
+		return NULL;
+	}
+	
+	// if it still fits where it is, leave it there
+	u32int old_size = kmalloc_usable_size(ptr);
+	
+	if (size <= old_size)
+	{
+		return ptr;
+	}
+	
+	u32int *result = kmalloc(size);
+	
+	if (result == NULL)
+	{
+		return NULL;
+	}
+	
+	memcpy((u8int *) result, (const u8int *) ptr, old_size);
+	kfree(ptr);
+	
+	return result;
+}
+
+void kmalloc_print_stats()
+{
+	for (u32int i = 0; i < KMALLOC_CLASSES; i++)
+	{
+		put_str("\n");
+		put_dec(1 << (KMALLOC_MIN_SHIFT + i));
+		put_str(" bytes: hits=");
+		put_dec(kmalloc_stats.hits[i]);
+		put_str(" misses=");
+		put_dec(kmalloc_stats.misses[i]);
+		put_str(" in use=");
+		put_dec(kmalloc_caches[i]->objects_in_use);
+		put_str(" slabs=");
+		put_dec(kmalloc_caches[i]->slabs);
+	}
+	
+	put_str("\nSpans: allocs=");
+	put_dec(kmalloc_stats.span_allocs);
+	put_str(" pages=");
+	put_dec(kmalloc_stats.span_pages);
+	put_str("\n");
+}
+
+// figures out which power of two the size rounds up to
+static u32int kmalloc_class(u32int size)
+{
+	if (size <= (1 << KMALLOC_MIN_SHIFT))
+	{
+		return 0;
+	}
+	
+	return (32 - __builtin_clz(size - 1)) - KMALLOC_MIN_SHIFT;
+}
+
+static u32int *kmalloc_span(u32int size)
+{
+	u32int pages = (size + 0xFFF) >> 12;
+	
+	if (pages == 0)
+	{
+		return NULL;
+	}
+	
+	u32int span_addr = (u32int) malloc_above(pages << 12, 0x1000, VMM_KERNEL_START);
+	
+	if (span_addr == NULL)
+	{
+		return NULL;
+	}
+	
+	// put frames behind the whole span now, so using it doesn't take a page fault every 4 KB
+	for (u32int i = 0; i < pages; i++)
+	{
+		u32int phys_addr = alloc_frame();
+		
+		if (phys_addr == 0xFFFFFFFF)
+		{
+			// give back what i've got so far
+			for (u32int j = 0; j < i; j++)
+			{
+				free_frame(virt_to_phys(current_page_directory, span_addr + (j << 12)));
+			}
+			
+			unmap_range(span_addr, i);
+			
+			free((u32int *) span_addr);
+			return NULL;
+		}
+		
+		map_page(span_addr + (i << 12), phys_addr, PAGE_KERNEL);
+	}
+	
+	kmalloc_stats.span_allocs++;
+	kmalloc_stats.span_pages += pages;
+	
+	return (u32int *) span_addr;
+}
+
+static void kfree_span(u32int *ptr)
+{
+	list_node_type *span_node = search_used(ptr);
+	
+	if (span_node == NULL)
+	{
+		return;
+	}
+	
+	u32int span_addr = (u32int) ptr;
+	u32int pages = ((vmm_data_type *) span_node->data)->size >> 12;
+	
+	for (u32int i = 0; i < pages; i++)
+	{
+		u32int phys_addr = virt_to_phys(current_page_directory, span_addr + (i << 12));
+		
+		if (phys_addr != 0xFFFFFFFF)
+		{
+			free_frame(phys_addr);
+		}
+	}
+	
+	// take the whole span out of the page tables at once, so the TLB gets flushed once
+	unmap_range(span_addr, pages);
+	
+	free(ptr);
+	
+	kmalloc_stats.span_allocs--;
+	kmalloc_stats.span_pages -= pages;
+}
+
+static u32int kmalloc_usable_size(u32int *ptr)
+{
+	if (((u32int) ptr & 0xFFF) == 0)
+	{
+		list_node_type *span_node = search_used(ptr);
+		
+		if (span_node == NULL)
+		{
+			return 0;
+		}
+		
+		return ((vmm_data_type *) span_node->data)->size;
+	}
+	
+	kmem_slab_type *slab = (kmem_slab_type *) ((u32int) ptr & ~(KMEM_SLAB_SIZE - 1));
+	return slab->cache->object_size;
+}
@@ -1,50 +1,113 @@
 #include <memory.h>
- 
+
+// memcmp reads bytes a word at a time, so the compiler has to know the word can alias anything
+typedef u32int __attribute__((may_alias)) memory_word;
+
+/*
+ * These all move 4 bytes at a time with the string instructions, and only
+ * fall back to single bytes for the ragged edges. memcpy and memset line the
+ * destination up on 4 bytes first, since that's the side the CPU cares about
+ * most, and whatever's left over at the end gets done a byte at a time.
+ */
+
 void memcpy(u8int *dest, const u8int *src, u32int len)
 {
-	const u8int *sp = (const u8int *) src;
-	u8int *dp = (u8int *) dest;
-	while (len--)
+	// copy bytes until the destination is lined up on 4 bytes
+	u32int head = (4 - ((u32int) dest & 0x3)) & 0x3;
+	
+	if (head > len)
 	{
-		*dp++ = *sp++;
+		head = len;
 	}
+	
+	len -= head;
+	
+	asm volatile (
+		"rep movsb\n\t"
+		"mov %3, %%ecx\n\t"
+		"shr $2, %%ecx\n\t"
+		"rep movsl\n\t"
+		"mov %3, %%ecx\n\t"
+		"and $3, %%ecx\n\t"
+		"rep movsb"
+		: "+D" (dest), "+S" (src), "+c" (head)
+		: "r" (len)
+		: "memory"
+	);
 }
 
 void memset(u8int *dest, u8int val, u32int len)
 {
-	u8int *temp = (u8int *) dest;
-	while (len--)
+	// copy the byte in to all four bytes of a word
+	u32int pattern = val * 0x01010101;
+	
+	// set bytes until the destination is lined up on 4 bytes
+	u32int head = (4 - ((u32int) dest & 0x3)) & 0x3;
+	
+	if (head > len)
 	{
-		*temp++ = val;
+		head = len;
 	}
+	
+	len -= head;
+	
+	asm volatile (
+		"rep stosb\n\t"
+		"mov %3, %%ecx\n\t"
+		"shr $2, %%ecx\n\t"
+		"rep stosl\n\t"
+		"mov %3, %%ecx\n\t"
+		"and $3, %%ecx\n\t"
+		"rep stosb"
+		: "+D" (dest), "+c" (head), "+a" (pattern)
+		: "r" (len)
+		: "memory"
+	);
 }
 
 void memmove(u8int *dest, u8int *src, u32int len)
 {
-	u8int *sp = (u8int *) src;
-	u8int *dp = (u8int *) dest;
-	if (dp < sp)
+	// if the destination is below the source, or they don't overlap, copying forward is safe
+	if ((dest <= src) || (dest >= src + len))
 	{
-		while (len--)
-		{
-			*dp++ = *sp++;
-		}
-	}
-	else
-	{
-		u8int *lasts = sp + (len - 1);
-		u8int *lastd = dp + (len - 1);
-		while (len--)
-		{
-			*lastd-- = *lasts--;
-		}
+		memcpy(dest, src, len);
+		return;
 	}
+	
+	// otherwise copy backward, starting with the odd bytes at the end, and then the words
+	u32int words = len >> 2;
+	u32int tail = len & 0x3;
+	u8int *last_dest = dest + len - 1;
+	u8int *last_src = src + len - 1;
+	
+	asm volatile (
+		"std\n\t"
+		"rep movsb\n\t"
+		"sub $3, %%edi\n\t"
+		"sub $3, %%esi\n\t"
+		"mov %3, %%ecx\n\t"
+		"rep movsl\n\t"
+		"cld"
+		: "+D" (last_dest), "+S" (last_src), "+c" (tail)
+		: "r" (words)
+		: "memory"
+	);
 }
 
 int memcmp(const u8int *src1, const u8int *src2, u32int len)
 {
 	const u8int *s1 = (const u8int *) src1;
 	const u8int *s2 = (const u8int *) src2;
+	
+	// skip over the words that match
+	while ((len >= 4) && (*(const memory_word *) s1 == *(const memory_word *) s2))
+	{
+		s1 += 4;
+		s2 += 4;
+		len -= 4;
+	}
+	
+	// then find the first byte that's different
 	while (len--)
 	{
 		if (*s1++ != *s2++)
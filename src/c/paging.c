@@ -1,14 +1,45 @@
 #include <paging.h>
 
 extern bitmap_type *pmm_frames;
+extern u32int pmm_metadata_end;
+extern u32int pmm_num_frames;
 extern u32int kernel_start;
 extern u32int kernel_end;
 
 page_directory_type kernel_page_directory;
 page_directory_type *current_page_directory;
 
+// PAGE_GLOBAL if the processor supports global pages, or nothing if it doesn't
+u32int paging_global_flag = 0;
+
+// TRUE if the processor can do 4 MB pages
+boolean paging_large_pages = FALSE;
+
+// where the direct map of physical memory ends
+u32int paging_direct_map_end = 0;
+
+// a bit for each slot on the temporary mapping window that's in use
+u32int kmap_slots_used = 0;
+
+// if this is TRUE the page fault handler says what it's doing
+boolean paging_fault_debug = FALSE;
+
+// the most pages a fault can map, how many the last one mapped, and where the
+// next fault would be if something's walking through memory from front to back
+u32int paging_fault_around_max = PAGING_FAULT_AROUND_MAX;
+u32int paging_fault_window = 0;
+u32int paging_fault_next = 0;
+
+// translations virt_to_phys has done for the current page directory, picked by the low bits
+// of the page number. anything that invalidates the TLB invalidates these too.
+paging_xlate_type paging_xlate[PAGING_XLATE_ENTRIES];
+u32int paging_xlate_hits = 0;
+u32int paging_xlate_misses = 0;
+
 void paging_initialize()
 {
+	paging_xlate_flush();
+	
 	/*
 	put_str("\nPaging initialize...");
 	
@@ -43,8 +74,8 @@ void paging_initialize()
 	 * 4 MB of space that was mapped when the kernel was loaded.
 	 */
 
-	// figure out where I'd like to put the page directory
-	u32int page_dir_virt_addr = (u32int) pmm_frames->addr + pmm_frames->bytes;
+	// figure out where I'd like to put the page directory (right after the PMM's bitmap and buddy trees)
+	u32int page_dir_virt_addr = pmm_metadata_end;
 
 	// make sure that address is page aligned.
 	if (page_dir_virt_addr % 0x1000 != 0)
@@ -55,6 +86,9 @@ void paging_initialize()
 	// figure out where i'd like to put the page table
 	u32int page_table_virt_addr = page_dir_virt_addr + 0x1000;
 	
+	// and the page table for the temporary mapping window goes after that
+	u32int kmap_table_virt_addr = page_table_virt_addr + 0x1000;
+	
 	/*
 	put_str("\npage_dir_virt_addr=");
 	put_hex(page_dir_virt_addr);
@@ -64,7 +98,7 @@ void paging_initialize()
 
 	// make sure both of these are in the mapped 4MB of memory
 	// if the page directory address, or page table address, will put any part of the structure outside the mapped memory
-	if ((page_dir_virt_addr > 0xC03FE000) || (page_table_virt_addr >0xC03FE000))
+	if ((page_dir_virt_addr > 0xC03FE000) || (page_table_virt_addr > 0xC03FE000) || (kmap_table_virt_addr > 0xC03FE000))
 	{
 		// throw a coniption and refuse to play any more.
 		put_str("\nUnable to initialize paging.");
@@ -73,6 +107,8 @@ void paging_initialize()
 		put_hex(page_dir_virt_addr);
 		put_str("\npage_table_virt_addr=");
 		put_hex(page_table_virt_addr);
+		put_str("\nHalting.");
+		for (;;) {}
 	}
 
 	/*
@@ -83,6 +119,7 @@ void paging_initialize()
 	
 	u32int page_dir_phys_addr = page_dir_virt_addr - 0xC0000000;
 	u32int page_table_phys_addr = page_table_virt_addr - 0xC0000000;
+	u32int kmap_table_phys_addr = kmap_table_virt_addr - 0xC0000000;
 	
 	/*
 	put_str("\npage_dir_phys_addr=");
@@ -110,9 +147,15 @@ void paging_initialize()
 	// i need to clear out that 4 KB of space
 	memset((u8int *) page_table_ptr, 0, 4096);
 	
+	// if the processor can do global pages, the kernel's pages are global
+	if (cpu_has_feature(CPU_FEATURE_PGE))
+	{
+		paging_global_flag = PAGE_GLOBAL;
+	}
+	
 	for (u32int i = 0; i < 1024; i++)
 	{
-		page_table_ptr[i] = (i * 0x1000) | 3;
+		page_table_ptr[i] = (i * 0x1000) | 3 | paging_global_flag;
 	}
 	
 	// i need to figure out the index for the kernel page directory entry
@@ -121,6 +164,10 @@ void paging_initialize()
 	// i need to put the physical address of the page table on the page directory
 	page_dir_ptr[kernel_index] = page_table_phys_addr | 3;
 	
+	// the temporary mapping window starts out with nothing on it
+	memset((u8int *) kmap_table_virt_addr, 0, 4096);
+	page_dir_ptr[KMAP_WINDOW_START >> 22] = kmap_table_phys_addr | 3;
+	
 	// i need to set up the recursive mappings on the page directory.
 	page_dir_ptr[1023] = page_dir_phys_addr | 3;
 	
@@ -133,11 +180,16 @@ void paging_initialize()
 	{
 		kernel_page_directory.tables[i].virt_addr = 0;
 		kernel_page_directory.tables[i].phys_addr = 0;
+		kernel_page_directory.tables[i].live = 0;
 	}
 	
 	// put the stuff for the kernel page table on the data structures
 	kernel_page_directory.tables[kernel_index].virt_addr = (u32int *) 0xFFF00000;
 	kernel_page_directory.tables[kernel_index].phys_addr = page_table_phys_addr;
+	kernel_page_directory.tables[kernel_index].live = 1024;
+	
+	kernel_page_directory.tables[KMAP_WINDOW_START >> 22].virt_addr = (u32int *) KMAP_WINDOW_TABLE;
+	kernel_page_directory.tables[KMAP_WINDOW_START >> 22].phys_addr = kmap_table_phys_addr;
 	
 	kernel_page_directory.tables[1023].virt_addr = (u32int *) 0xFFC00000;
 	kernel_page_directory.tables[1023].phys_addr = page_dir_phys_addr;
@@ -145,8 +197,28 @@ void paging_initialize()
 	// set the kernel page directory as the current page directory
 	current_page_directory = (page_directory_type *) &kernel_page_directory;
 	
-	// i need to figure out what to put on CR4 to switch the system to 4 KB pages
-	u32int new_cr4_val = read_cr4() & ~(0x00000010);
+	// i need to figure out what to put on CR4. the kernel's first 4 MB is on a 4 KB page table
+	// from here on, but if the processor can do 4 MB pages i leave PSE on for the direct map.
+	u32int new_cr4_val = read_cr4();
+	
+	if (cpu_has_feature(CPU_FEATURE_PSE))
+	{
+		paging_large_pages = TRUE;
+		new_cr4_val |= 0x00000010;
+	}
+	else
+	{
+		new_cr4_val &= ~(0x00000010);
+	}
+	
+	// and turn global pages on, if there are any
+	if (paging_global_flag != 0)
+	{
+		new_cr4_val |= 0x00000080;
+	}
+	
+	// make writes from the kernel respect read only pages too, or copy on write would never see them
+	write_cr0(read_cr0() | 0x00010000);
 	
 	// time to do the magic
 	// switch the system over to 4KB paging, and give it the phys addr of the new page dir
@@ -158,54 +230,148 @@ void paging_initialize()
 	);
 	// say a prayer.
 	
+	// map the rest of low physical memory in to the kernel's half
+	paging_map_direct();
+	
 	// register my interrupt handler
 	register_interrupt_handler(14, (isr) &page_fault_interrupt_handler);
 	
 	//put_str("\nDone.\n");
 }
 
-void page_fault_interrupt_handler(registers regs)
+void page_fault_interrupt_handler(registers *regs)
 {
+	if (paging_fault_debug)
+	{
+		put_str("\nPage fault interrupt handler called.");
+	}
 	
-	put_str("\nPage fault interrupt handler called.");
-	
-	
-	u32int present = regs.err_code & 0x1;
-	u32int rw = regs.err_code & 0x2;
-	u32int us = regs.err_code & 0x4;
+	u32int present = regs->err_code & 0x1;
+	u32int rw = regs->err_code & 0x2;
+	u32int us = regs->err_code & 0x4;
 	
 	if (!present)
 	{
 		// gather information
 		u32int faulting_virt_addr = read_cr2();
+		u32int fault_page = faulting_virt_addr & ~(0xFFF);
+		
+		if (paging_fault_debug)
+		{
+			put_str("\nfaulting_virt_addr=");
+			put_hex(faulting_virt_addr);
+		}
 		
-		put_str("\nfaulting_virt_addr=");
-		put_hex(faulting_virt_addr);
+		// the kernel might have made a page table this address space hasn't heard about yet
+		if ((faulting_virt_addr >= 0xC0000000) && (sync_kernel_table(faulting_virt_addr >> 22)))
+		{
+			return;
+		}
 		
-		u32int phys_addr = alloc_frame();
+		// the kernel's half of memory gets kernel pages, and everything below it is private to the address space
+		u32int flags = PAGE_PRESENT | PAGE_WRITE;
 		
-		put_str("\nphys_addr=");
-		put_hex(phys_addr);
+		if (faulting_virt_addr >= 0xC0000000)
+		{
+			flags = PAGE_KERNEL;
+		}
 		
-		map_page(faulting_virt_addr, phys_addr);
+		// figure out how many pages to map. if the fault is inside something that was malloc'd
+		// i map some of the pages after it too, and more of them if it looks like the region
+		// is being walked through from front to back.
+		u32int window_end = fault_page + 0x1000;
+		vmm_data_type *region = vmm_region_containing(faulting_virt_addr);
 		
-		// refresh the cr3 value
-		write_cr3(read_cr3());
+		if (region != NULL)
+		{
+			if (fault_page == paging_fault_next)
+			{
+				paging_fault_window <<= 1;
+			}
+			else
+			{
+				paging_fault_window = PAGING_FAULT_AROUND_MIN;
+			}
+			
+			if (paging_fault_window > paging_fault_around_max)
+			{
+				paging_fault_window = paging_fault_around_max;
+			}
+			
+			if (paging_fault_window == 0)
+			{
+				paging_fault_window = 1;
+			}
+			
+			u32int region_end = region->virt_addr + region->size;
+			u32int region_last_page = (region_end - 1) & ~(0xFFF);
+			
+			window_end = fault_page + (paging_fault_window << 12);
+			
+			// don't go past the end of the region, or wrap around the top of memory
+			if ((window_end < fault_page) || (window_end > region_last_page + 0x1000) || (region_last_page + 0x1000 == 0))
+			{
+				window_end = region_last_page + 0x1000;
+			}
+			
+			paging_fault_next = window_end;
+		}
 		
-		// tell the TLB that the page table entry has been updated.
-		invlpg((faulting_virt_addr & ~(0xFFF)));
+		u32int virt_addr = fault_page;
 		
-		return;
+		do
+		{
+			// the fault is on a page that isn't there, but the ones after it might be
+			if ((virt_addr == fault_page) || (virt_to_phys(current_page_directory, virt_addr) == 0xFFFFFFFF))
+			{
+				// the frame has to be cleared, so nothing left over from whoever had it before shows up
+				u32int phys_addr = alloc_zeroed_frame();
+				
+				if (phys_addr == 0xFFFFFFFF)
+				{
+					// the page that faulted has to be mapped, but the rest were only a guess
+					if (virt_addr != fault_page)
+					{
+						break;
+					}
+					
+					put_str("\nOut of memory.");
+					put_str("\nHalting system.");
+					for (;;) {}
+				}
+				
+				if (paging_fault_debug)
+				{
+					put_str("\nvirt_addr=");
+					put_hex(virt_addr);
+					put_str(" phys_addr=");
+					put_hex(phys_addr);
+				}
+				
+				// map_page flushes the TLB for the page it maps, so nothing else needs to be thrown away
+				map_page(virt_addr, phys_addr, flags);
+			}
+			
+			virt_addr += 0x1000;
+		} while (virt_addr != window_end);
 		
+		return;
 	}
 	else if (rw)
 	{
 		u32int cr2_val = read_cr2();
+		
+		// a write to a page that's shared copy on write gets its own copy of the page
+		if (copy_on_write(cr2_val))
+		{
+			return;
+		}
+		
 		put_str("\nWrite fault. Memory at ");
 		put_hex(cr2_val);
 		put_str(" is read only.");
 		put_str("\nError code: ");
-		put_hex(regs.err_code);
+		put_hex(regs->err_code);
 		put_str("\nHalting system.");
 		for (;;) {}
 	}
@@ -216,7 +382,7 @@ void page_fault_interrupt_handler(registers regs)
 		put_hex(cr2_val);
 		put_str(" is reserved for supervisor.");
 		put_str("\nError code: ");
-		put_hex(regs.err_code);
+		put_hex(regs->err_code);
 		put_str("\nHalting system.");
 		for (;;) {}
 	}
@@ -224,7 +390,7 @@ void page_fault_interrupt_handler(registers regs)
 	{
 		put_str("\nUnknown page fault exception has occured.");
 		put_str("\nError code: ");
-		put_hex(regs.err_code);
+		put_hex(regs->err_code);
 		put_str("\nHalting system.");
 		for (;;) {}
 	}
@@ -239,12 +405,43 @@ void page_fault_interrupt_handler(registers regs)
 void invlpg(u32int addr)
 {
 	asm volatile ("invlpg (%0)" : : "b" (addr) : "memory");
+	
+	paging_xlate_type *xlate = &paging_xlate[(addr >> 12) & (PAGING_XLATE_ENTRIES - 1)];
+	
+	if (xlate->virt_page == (addr & ~(0xFFF)))
+	{
+		xlate->virt_page = 0xFFFFFFFF;
+	}
+}
+
+void paging_xlate_flush()
+{
+	for (u32int i = 0; i < PAGING_XLATE_ENTRIES; i++)
+	{
+		paging_xlate[i].virt_page = 0xFFFFFFFF;
+	}
 }
 
 u32int virt_to_phys(page_directory_type *page_directory, u32int virt_addr)
 {
 	u32int result = 0xFFFFFFFF;
 	
+	// the cache only holds the current page directory's translations
+	paging_xlate_type *xlate = NULL;
+	
+	if (page_directory == current_page_directory)
+	{
+		xlate = &paging_xlate[(virt_addr >> 12) & (PAGING_XLATE_ENTRIES - 1)];
+		
+		if (xlate->virt_page == (virt_addr & ~(0xFFF)))
+		{
+			paging_xlate_hits++;
+			return xlate->phys_page + (virt_addr & 0xFFF);
+		}
+		
+		paging_xlate_misses++;
+	}
+	
 	// calculate the page directory index, table index, and table offset
 	u32int page_dir_index = virt_addr >> 22;
 	u32int page_table_index = (virt_addr >> 12) & 0x3FF;
@@ -256,26 +453,151 @@ u32int virt_to_phys(page_directory_type *page_directory, u32int virt_addr)
 	// if there's something present at that page directory index
 	if (page_dir_ptr[page_dir_index] & 0x1)
 	{
-		// make a pointer to the page table
-		u32int *page_table_ptr = page_directory->tables[page_dir_index].virt_addr;
+		// a 4 MB page doesn't have a page table, the address is right on the page directory entry
+		if (page_dir_ptr[page_dir_index] & PAGE_LARGE)
+		{
+			result = (page_dir_ptr[page_dir_index] & 0xFFC00000) + (virt_addr & 0x3FFFFF);
+		}
+		else
+		{
+			// make a pointer to the page table
+			u32int *page_table_ptr = page_directory->tables[page_dir_index].virt_addr;
+			
+			if (page_dir_index == 1023)
+			{
+				page_table_ptr = page_dir_ptr;
+			}
+			
+			// if the page table entry for the physical address i'm curious about is present
+			if (page_table_ptr[page_table_index] & 0x1)
+			{
+				// calculate the result
+				result = (page_table_ptr[page_table_index] & ~(0xFFF)) + table_offset;
+			}
+		}
+	}
+	
+	// remember it for next time
+	if ((xlate != NULL) && (result != 0xFFFFFFFF))
+	{
+		xlate->virt_page = virt_addr & ~(0xFFF);
+		xlate->phys_page = result & ~(0xFFF);
+	}
+	
+	return result;
+}
+
+// adds a piece to the end of an extent list, or stretches the last extent if the piece follows right on from it.
+// returns how many extents are used now, or 0xFFFFFFFF if there wasn't room.
+static u32int add_extent(phys_extent_type *extents, u32int used, u32int max_extents, u32int phys_addr, u32int size)
+{
+	if ((used > 0) && (extents[used - 1].phys_addr + extents[used - 1].size == phys_addr))
+	{
+		extents[used - 1].size += size;
+		return used;
+	}
+	
+	if (used == max_extents)
+	{
+		return 0xFFFFFFFF;
+	}
+	
+	extents[used].phys_addr = phys_addr;
+	extents[used].size = size;
+	
+	return used + 1;
+}
+
+u32int virt_to_phys_range(page_directory_type *page_directory, u32int virt_addr, u32int size, phys_extent_type *extents, u32int max_extents)
+{
+	/*
+	 * Fills in the list of physical extents behind a buffer, and returns how
+	 * many of them there are. Physically contiguous pages come out as a single
+	 * extent. The page directory entry is only looked at once for each 4 MB,
+	 * and the page table is walked straight through from there, rather than
+	 * starting from the top for every page. If any of the buffer isn't mapped,
+	 * or there are more extents than fit on the list, it returns 0xFFFFFFFF.
+	 */
+	
+	u32int used = 0;
+	u32int *page_dir_ptr = page_directory->virt_addr;
+	
+	while (size > 0)
+	{
+		u32int page_dir_index = virt_addr >> 22;
+		u32int page_dir_entry = page_dir_ptr[page_dir_index];
+		
+		// how much of the buffer is under this page directory entry
+		u32int chunk = 0x400000 - (virt_addr & 0x3FFFFF);
+		
+		if (chunk > size)
+		{
+			chunk = size;
+		}
 		
-		if (page_dir_index == 1023)
+		if ((page_dir_entry & 0x1) == 0)
 		{
-			page_table_ptr = page_dir_ptr;
+			return 0xFFFFFFFF;
 		}
 		
-		// if the page table entry for the physical address i'm curious about is present
-		if (page_table_ptr[page_table_index] & 0x1)
+		if (page_dir_entry & PAGE_LARGE)
+		{
+			// a 4 MB page is all one piece
+			used = add_extent(extents, used, max_extents, (page_dir_entry & 0xFFC00000) + (virt_addr & 0x3FFFFF), chunk);
+			
+			if (used == 0xFFFFFFFF)
+			{
+				return 0xFFFFFFFF;
+			}
+		}
+		else
 		{
-			// calculate the result
-			result = (page_table_ptr[page_table_index] & ~(0xFFF)) + table_offset;
+			u32int *page_table_ptr = page_directory->tables[page_dir_index].virt_addr;
+			
+			if (page_dir_index == 1023)
+			{
+				page_table_ptr = page_dir_ptr;
+			}
+			
+			u32int done = 0;
+			
+			while (done < chunk)
+			{
+				u32int addr = virt_addr + done;
+				u32int entry = page_table_ptr[(addr >> 12) & 0x3FF];
+				
+				if ((entry & 0x1) == 0)
+				{
+					return 0xFFFFFFFF;
+				}
+				
+				// the first and last pages might only be partly in the buffer
+				u32int piece = 0x1000 - (addr & 0xFFF);
+				
+				if (piece > chunk - done)
+				{
+					piece = chunk - done;
+				}
+				
+				used = add_extent(extents, used, max_extents, (entry & ~(0xFFF)) + (addr & 0xFFF), piece);
+				
+				if (used == 0xFFFFFFFF)
+				{
+					return 0xFFFFFFFF;
+				}
+				
+				done += piece;
+			}
 		}
+		
+		virt_addr += chunk;
+		size -= chunk;
 	}
 	
-	return result;
+	return used;
 }
 
-void map_page(u32int virt_addr, u32int phys_addr)
+void map_page(u32int virt_addr, u32int phys_addr, u32int flags)
 {
 	// sanitise the inputs and make sure both of the addresses are page aligned.
 	// examine the virtual address to determine the page dir index, and page table index
@@ -291,103 +613,398 @@ void map_page(u32int virt_addr, u32int phys_addr)
 	u32int page_dir_index = virt_addr >> 22;
 	u32int page_table_index = (virt_addr >> 12) & 0x3FF;
 	
-	// create a pointer the page directory so i can work with it
-	u32int *page_directory = current_page_directory->virt_addr;
+	// get a pointer to the page table so i can alter it, and make one if there isn't one
+	u32int *page_table = get_page_table(page_dir_index, phys_addr, 1);
 	
-	// if there's no page table for the frame
-	if ((page_directory[page_dir_index] & 0x1) == 0)
+	// don't mark anything global if the processor doesn't know what that means
+	if (paging_global_flag == 0)
 	{
-		// create a page table
+		flags &= ~(PAGE_GLOBAL);
+	}
+	
+	// keep count of what's on the table
+	if ((page_table[page_table_index] & 0x1) == 0)
+	{
+		current_page_directory->tables[page_dir_index].live++;
+	}
+	
+	// map the physical address
+	page_table[page_table_index] = phys_addr | flags;
+	
+	// flush the TLB for that page
+	invlpg(virt_addr);
+	
+	return;
+}
+
+void unmap_page(u32int virt_addr)
+{
+	unmap_range(virt_addr, 1);
+}
+
+void map_range(u32int virt_addr, u32int phys_addr, u32int count, u32int flags)
+{
+	virt_addr &= ~(0xFFF);
+	phys_addr &= ~(0xFFF);
+	
+	u32int start_addr = virt_addr;
+	u32int remaining = count;
+	
+	if (paging_global_flag == 0)
+	{
+		flags &= ~(PAGE_GLOBAL);
+	}
+	
+	// work through the range one page table at a time
+	while (remaining > 0)
+	{
+		u32int page_dir_index = virt_addr >> 22;
+		u32int page_table_index = (virt_addr >> 12) & 0x3FF;
 		
-		// allocate a frame for the new page table
-		u32int table_phys_addr = alloc_frame();
+		// figure out how much of the range lands on this page table
+		u32int span = 1024 - page_table_index;
 		
-		// make sure that's not the page we're trying to map
-		if (table_phys_addr == phys_addr)
+		if (span > remaining)
 		{
-			u32int temp = table_phys_addr;
-			table_phys_addr = alloc_frame();
-			free_frame(temp);
+			span = remaining;
 		}
 		
-		// create a pointer to the kernel's page table
-		u32int *kernel_page_table = current_page_directory->tables[768].virt_addr;
+		u32int *page_table = get_page_table(page_dir_index, phys_addr, remaining);
 		
-		// store the value on PT10 for later
-		u32int PT10_tmp = kernel_page_table[10];
+		for (u32int i = 0; i < span; i++)
+		{
+			if ((page_table[page_table_index + i] & 0x1) == 0)
+			{
+				current_page_directory->tables[page_dir_index].live++;
+			}
+			
+			page_table[page_table_index + i] = (phys_addr + (i << 12)) | flags;
+		}
 		
-		// map the new page to 0xC000A000
-		kernel_page_table[10] = table_phys_addr | 3;
+		virt_addr += span << 12;
+		phys_addr += span << 12;
+		remaining -= span;
+	}
+	
+	flush_range(start_addr, count);
+}
+
+void unmap_range(u32int virt_addr, u32int count)
+{
+	virt_addr &= ~(0xFFF); // sanitize the address, and make sure it's page aligned
+	
+	u32int start_addr = virt_addr;
+	u32int remaining = count;
+	
+	// create a pointer the page directory so i can work with it
+	u32int *page_directory = current_page_directory->virt_addr;
+	
+	while (remaining > 0)
+	{
+		u32int page_dir_index = virt_addr >> 22;
+		u32int page_table_index = (virt_addr >> 12) & 0x3FF;
 		
-		// create a pointer ot the new page so i can alter it
-		u32int *page_table = (u32int *) 0xC000A000;
+		u32int span = 1024 - page_table_index;
 		
-		// clear it
-		memset((u8int *) page_table, 0, 4096);
+		if (span > remaining)
+		{
+			span = remaining;
+		}
 		
-		// create a page table in there.
-		for (u32int i = 0; i < 1024; i++)
+		// if there's a page table for that part of the range (4 MB pages are left alone)
+		if ((page_directory[page_dir_index] & 0x1) && ((page_directory[page_dir_index] & PAGE_LARGE) == 0))
 		{
-			page_table[i] = 0 | 2;
+			// create a pointer to the page table so i can alter it
+			u32int *page_table = current_page_directory->tables[page_dir_index].virt_addr;
+			
+			// unmap the pages
+			for (u32int i = 0; i < span; i++)
+			{
+				if (page_table[page_table_index + i] & 0x1)
+				{
+					current_page_directory->tables[page_dir_index].live--;
+				}
+				
+				page_table[page_table_index + i] = 0;
+			}
+			
+			// if that was the last thing on the table, the table can go too
+			if (current_page_directory->tables[page_dir_index].live == 0)
+			{
+				release_page_table(page_dir_index);
+			}
 		}
 		
-		// put the physical address of the new page table on the page directory at the proper index
-		page_directory[page_dir_index] = table_phys_addr | 3;
+		virt_addr += span << 12;
+		remaining -= span;
+	}
+	
+	flush_range(start_addr, count);
+}
+
+void map_large_range(u32int virt_addr, u32int phys_addr, u32int size, u32int flags)
+{
+	virt_addr &= ~(0xFFF);
+	phys_addr &= ~(0xFFF);
+	size = (size + 0xFFF) & ~(0xFFF);
+	
+	u32int *page_directory = current_page_directory->virt_addr;
+	
+	if (paging_global_flag == 0)
+	{
+		flags &= ~(PAGE_GLOBAL);
+	}
+	
+	while (size > 0)
+	{
+		u32int page_dir_index = virt_addr >> 22;
 		
-		// figure out the recursive address for the new page table
-		u32int page_table_recursive_addr = 0xFFC00000 + (0x1000 * page_dir_index);
+		// if both addresses are on a 4 MB boundary, there's at least 4 MB left, and nothing's
+		// mapped there already, the whole 4 MB goes on the page directory entry
+		if ((paging_large_pages) && ((virt_addr & 0x3FFFFF) == 0) && ((phys_addr & 0x3FFFFF) == 0)
+			&& (size >= 0x400000) && ((page_directory[page_dir_index] & 0x1) == 0))
+		{
+			page_directory[page_dir_index] = phys_addr | flags | PAGE_LARGE;
+			
+			current_page_directory->tables[page_dir_index].virt_addr = 0;
+			current_page_directory->tables[page_dir_index].phys_addr = 0;
+			
+			invlpg(virt_addr);
+			
+			virt_addr += 0x400000;
+			phys_addr += 0x400000;
+			size -= 0x400000;
+			continue;
+		}
 		
-		// populate the proper values on the data structure
-		current_page_directory->tables[page_dir_index].virt_addr = (u32int *) page_table_recursive_addr;
-		current_page_directory->tables[page_dir_index].phys_addr = table_phys_addr;
+		// otherwise map 4 KB pages up to the next 4 MB boundary
+		u32int span = 0x400000 - (virt_addr & 0x3FFFFF);
 		
-		// restore the original mapping on PT10
-		kernel_page_table[10] = PT10_tmp;
+		if (span > size)
+		{
+			span = size;
+		}
+		
+		map_range(virt_addr, phys_addr, span >> 12, flags);
+		
+		virt_addr += span;
+		phys_addr += span;
+		size -= span;
+	}
+}
+
+void paging_map_direct()
+{
+	// the first 4 MB is already mapped, and it stays on a 4 KB page table so the kernel
+	// image can have different attributes from page to page
+	u32int direct_map_size = pmm_num_frames << 12;
+	
+	if ((pmm_num_frames > (PAGING_DIRECT_MAP_MAX >> 12)) || (direct_map_size == 0))
+	{
+		direct_map_size = PAGING_DIRECT_MAP_MAX;
 	}
 	
-	// get the attributes for the page table
-	u32int table_attribs = get_table_attribs(page_dir_index);
+	// only whole 4 MB pieces get mapped
+	direct_map_size &= ~(0x3FFFFF);
 	
-	// create a pointer to the page table so i can alter it
-	u32int *page_table = current_page_directory->tables[page_dir_index].virt_addr;
+	if (direct_map_size > 0x400000)
+	{
+		map_large_range(0xC0400000, 0x400000, direct_map_size - 0x400000, PAGE_KERNEL);
+	}
+	else
+	{
+		direct_map_size = 0x400000;
+	}
 	
-	// map the physical address
-	page_table[page_table_index] = phys_addr | table_attribs;
+	paging_direct_map_end = 0xC0000000 + direct_map_size;
+}
+
+u32int *kmap_temp(u32int phys_addr)
+{
+	// find a slot on the window that isn't being used. the idle thread maps frames to zero them,
+	// so nothing can switch threads between finding the slot and taking it.
+	u32int eflags = interrupts_save();
 	
-	// flush the TLB for that page
+	if (kmap_slots_used == 0xFFFFFFFF)
+	{
+		put_str("\nThe temporary mapping window is full.");
+		put_str("\nHalting.");
+		for (;;) {}
+	}
+	
+	u32int slot = __builtin_ctz(~kmap_slots_used);
+	kmap_slots_used |= (u32int) 1 << slot;
+	
+	interrupts_restore(eflags);
+	
+	u32int virt_addr = KMAP_WINDOW_START + (slot << 12);
+	u32int *window_table = (u32int *) KMAP_WINDOW_TABLE;
+	
+	// the slot could have had something else on it before, so throw away the old translation
+	window_table[slot] = (phys_addr & ~(0xFFF)) | PAGE_PRESENT | PAGE_WRITE;
 	invlpg(virt_addr);
 	
-	return;
+	return (u32int *) virt_addr;
 }
 
-void unmap_page(u32int virt_addr)
+void kunmap_temp(u32int *virt_addr)
 {
-	virt_addr &= ~(0xFFF); // sanitize the address, and make sure it's page aligned
+	u32int slot = ((u32int) virt_addr - KMAP_WINDOW_START) >> 12;
 	
-	// figure out the page directory index, and page table index for the virtual address
-	u32int page_dir_index = virt_addr >> 22;
-	u32int page_table_index = (virt_addr >> 12) & 0x3FF;
+	if (slot >= KMAP_SLOTS)
+	{
+		return;
+	}
+	
+	u32int *window_table = (u32int *) KMAP_WINDOW_TABLE;
+	
+	window_table[slot] = 0;
+	invlpg(KMAP_WINDOW_START + (slot << 12));
+	
+	u32int eflags = interrupts_save();
+	kmap_slots_used &= ~((u32int) 1 << slot);
+	interrupts_restore(eflags);
+}
+
+void zero_frame(u32int phys_addr)
+{
+	u32int *page = kmap_temp(phys_addr);
+	memset((u8int *) page, 0, 4096);
+	kunmap_temp(page);
+}
+
+void flush_range(u32int virt_addr, u32int count)
+{
+	// a handful of pages gets flushed one at a time, but past that it's cheaper to throw the whole TLB away
+	if (count > PAGING_INVLPG_MAX)
+	{
+		flush_all();
+		return;
+	}
+	
+	for (u32int i = 0; i < count; i++)
+	{
+		invlpg(virt_addr + (i << 12));
+	}
+}
+
+void flush_all()
+{
+	// reloading CR3 leaves the global pages alone, so with those turned on i have to
+	// turn PGE off and back on to get rid of everything
+	paging_xlate_flush();
+	
+	if (paging_global_flag != 0)
+	{
+		u32int cr4_val = read_cr4();
+		write_cr4(cr4_val & ~(0x00000080));
+		write_cr4(cr4_val);
+		return;
+	}
 	
+	write_cr3(read_cr3());
+}
+
+u32int *get_page_table(u32int page_dir_index, u32int phys_addr, u32int count)
+{
 	// create a pointer the page directory so i can work with it
 	u32int *page_directory = current_page_directory->virt_addr;
 	
-	// if there's a page table for the frame
-	if (page_directory[page_dir_index] & 0x1)
+	// a 4 MB page can't have 4 KB pages put in it
+	if (page_directory[page_dir_index] & PAGE_LARGE)
 	{
-		// create a pointer to the page table so i can alter it
-		u32int *page_table = current_page_directory->tables[page_dir_index].virt_addr;
+		put_str("\nUnable to map a 4 KB page inside the 4 MB page at ");
+		put_hex(page_dir_index << 22);
+		put_str("\nHalting.");
+		for (;;) {}
+	}
+	
+	// the kernel's page tables are shared by every address space, so if the kernel's
+	// page directory already has one this address space can just use it
+	if (sync_kernel_table(page_dir_index))
+	{
+		return current_page_directory->tables[page_dir_index].virt_addr;
+	}
+	
+	// if there's no page table for that part of memory
+	if ((page_directory[page_dir_index] & 0x1) == 0)
+	{
+		// create a page table
 		
-		// unmap the page
-		page_table[page_table_index] = 0;
+		// allocate a frame for the new page table
+		u32int table_phys_addr = alloc_frame();
 		
-		// flush the TLB for that page
-		invlpg(virt_addr);
+		// make sure that's not one of the frames we're trying to map
+		if ((table_phys_addr >= phys_addr) && (table_phys_addr - phys_addr < (count << 12)))
+		{
+			u32int temp = table_phys_addr;
+			table_phys_addr = alloc_frame();
+			free_frame(temp);
+		}
+		
+		// clear it out, so there's nothing on it
+		zero_frame(table_phys_addr);
+		frame_set_owner(table_phys_addr, PMM_PAGE_TABLE, current_page_directory);
+		
+		// put the physical address of the new page table on the page directory at the proper index
+		page_directory[page_dir_index] = table_phys_addr | 3;
+		
+		// figure out the recursive address for the new page table
+		u32int page_table_recursive_addr = 0xFFC00000 + (0x1000 * page_dir_index);
+		
+		// populate the proper values on the data structure
+		current_page_directory->tables[page_dir_index].virt_addr = (u32int *) page_table_recursive_addr;
+		current_page_directory->tables[page_dir_index].phys_addr = table_phys_addr;
+		current_page_directory->tables[page_dir_index].live = 0;
+		
+		// make sure the recursive mapping for the table isn't left over from an old one
+		invlpg(page_table_recursive_addr);
+		
+		// if it's one of the kernel's tables, the kernel's page directory needs to have it too,
+		// so the other address spaces can find it
+		if ((page_dir_index >= (0xC0000000 >> 22)) && (current_page_directory != &kernel_page_directory))
+		{
+			kernel_page_directory.virt_addr[page_dir_index] = page_directory[page_dir_index];
+			kernel_page_directory.tables[page_dir_index] = current_page_directory->tables[page_dir_index];
+		}
+	}
+	
+	return current_page_directory->tables[page_dir_index].virt_addr;
+}
+
+void release_page_table(u32int page_dir_index)
+{
+	// the kernel's page tables are shared with every address space, so only tables
+	// below the kernel are ever given back
+	if (page_dir_index >= (0xC0000000 >> 22))
+	{
+		return;
+	}
+	
+	u32int *page_directory = current_page_directory->virt_addr;
+	
+	if (((page_directory[page_dir_index] & 0x1) == 0) || (page_directory[page_dir_index] & PAGE_LARGE))
+	{
+		return;
 	}
+	
+	u32int table_phys_addr = current_page_directory->tables[page_dir_index].phys_addr;
+	
+	// take it off the page directory, and get rid of the recursive mapping that pointed at it
+	page_directory[page_dir_index] = 0 | 2;
+	invlpg(0xFFC00000 + (page_dir_index << 12));
+	
+	current_page_directory->tables[page_dir_index].virt_addr = 0;
+	current_page_directory->tables[page_dir_index].phys_addr = 0;
+	current_page_directory->tables[page_dir_index].live = 0;
+	
+	free_frame(table_phys_addr);
 }
 
 void change_page_directory(page_directory_type *page_directory)
 {
 	current_page_directory = page_directory;
+	paging_xlate_flush();
 	asm volatile(
 		"mov %0, %%cr3"
 		: /* no outputs */
@@ -400,6 +1017,181 @@ u32int get_table_attribs(u32int page_dir_index)
 	return current_page_directory->virt_addr[page_dir_index] & 0xFFF;
 }
 
+page_directory_type *clone_address_space()
+{
+	page_directory_type *source = current_page_directory;
+	u32int *source_dir = source->virt_addr;
+	
+	// the new page directory, and the structure that keeps track of it, come out of the kernel heap
+	page_directory_type *dest = (page_directory_type *) kmalloc(sizeof(page_directory_type));
+	u32int *dest_dir = kmalloc(0x1000);
+	
+	if ((dest == NULL) || (dest_dir == NULL))
+	{
+		kfree((u32int *) dest);
+		kfree(dest_dir);
+		return NULL;
+	}
+	
+	dest->virt_addr = dest_dir;
+	dest->phys_addr = virt_to_phys(current_page_directory, (u32int) dest_dir);
+	
+	for (u32int i = 0; i < 1024; i++)
+	{
+		dest_dir[i] = 0 | 2;
+		dest->tables[i].virt_addr = 0;
+		dest->tables[i].phys_addr = 0;
+		dest->tables[i].live = 0;
+		
+		// the new page directory gets its own recursive mapping
+		if (i == 1023)
+		{
+			dest_dir[i] = dest->phys_addr | 3;
+			dest->tables[i].virt_addr = (u32int *) 0xFFC00000;
+			dest->tables[i].phys_addr = dest->phys_addr;
+			continue;
+		}
+		
+		if ((source_dir[i] & 0x1) == 0)
+		{
+			continue;
+		}
+		
+		// the kernel's page tables (and any 4 MB pages) are the same everywhere, so they're shared as they are
+		if ((i >= (0xC0000000 >> 22)) || (source_dir[i] & PAGE_LARGE))
+		{
+			dest_dir[i] = source_dir[i];
+			dest->tables[i] = source->tables[i];
+			continue;
+		}
+		
+		// everything else gets a new page table, with the same frames on it. anything that could be
+		// written to is made read only in both places, and copied when somebody writes to it.
+		u32int table_phys_addr = alloc_zeroed_frame();
+		
+		if (table_phys_addr == 0xFFFFFFFF)
+		{
+			put_str("\nOut of memory while cloning an address space.");
+			put_str("\nHalting.");
+			for (;;) {}
+		}
+		
+		frame_set_owner(table_phys_addr, PMM_PAGE_TABLE, dest);
+		
+		u32int *source_table = source->tables[i].virt_addr;
+		u32int *dest_table = kmap_temp(table_phys_addr);
+		
+		for (u32int j = 0; j < 1024; j++)
+		{
+			u32int entry = source_table[j];
+			
+			if (entry & 0x1)
+			{
+				if (entry & (PAGE_WRITE | PAGE_COW))
+				{
+					entry = (entry & ~(PAGE_WRITE)) | PAGE_COW;
+					source_table[j] = entry;
+				}
+				
+				frame_ref(entry & ~(0xFFF));
+			}
+			
+			dest_table[j] = entry;
+		}
+		
+		kunmap_temp(dest_table);
+		
+		dest_dir[i] = table_phys_addr | (source_dir[i] & 0xFFF);
+		dest->tables[i].virt_addr = (u32int *) (0xFFC00000 + (i << 12));
+		dest->tables[i].phys_addr = table_phys_addr;
+		dest->tables[i].live = source->tables[i].live;
+	}
+	
+	// the pages that were just made read only might still be writable in the TLB. none of them are global.
+	write_cr3(read_cr3());
+	paging_xlate_flush();
+	
+	return dest;
+}
+
+boolean copy_on_write(u32int virt_addr)
+{
+	u32int page_dir_index = virt_addr >> 22;
+	u32int page_table_index = (virt_addr >> 12) & 0x3FF;
+	u32int *page_directory = current_page_directory->virt_addr;
+	
+	if (((page_directory[page_dir_index] & 0x1) == 0) || (page_directory[page_dir_index] & PAGE_LARGE))
+	{
+		return FALSE;
+	}
+	
+	u32int *page_table = current_page_directory->tables[page_dir_index].virt_addr;
+	u32int entry = page_table[page_table_index];
+	
+	if (((entry & 0x1) == 0) || ((entry & PAGE_COW) == 0))
+	{
+		return FALSE;
+	}
+	
+	u32int page_addr = virt_addr & ~(0xFFF);
+	u32int old_phys_addr = entry & ~(0xFFF);
+	u32int flags = (entry & 0xFFF & ~(PAGE_COW)) | PAGE_WRITE;
+	
+	// if nobody else is using the frame any more, it can just be made writable again
+	if (frame_refcount(old_phys_addr) == 0)
+	{
+		page_table[page_table_index] = old_phys_addr | flags;
+		invlpg(page_addr);
+		return TRUE;
+	}
+	
+	// otherwise copy it to a frame of its own
+	u32int new_phys_addr = alloc_frame();
+	
+	if (new_phys_addr == 0xFFFFFFFF)
+	{
+		put_str("\nOut of memory while copying a page on write.");
+		put_str("\nHalting.");
+		for (;;) {}
+	}
+	
+	u32int *new_page = kmap_temp(new_phys_addr);
+	memcpy((u8int *) new_page, (const u8int *) page_addr, 4096);
+	kunmap_temp(new_page);
+	
+	page_table[page_table_index] = new_phys_addr | flags;
+	invlpg(page_addr);
+	
+	frame_unref(old_phys_addr);
+	
+	return TRUE;
+}
+
+boolean sync_kernel_table(u32int page_dir_index)
+{
+	// copies one of the kernel's page tables from the kernel's page directory, if it's
+	// there and the current page directory doesn't have it yet
+	if ((page_dir_index < (0xC0000000 >> 22)) || (page_dir_index == 1023) || (current_page_directory == &kernel_page_directory))
+	{
+		return FALSE;
+	}
+	
+	u32int *page_directory = current_page_directory->virt_addr;
+	u32int kernel_entry = kernel_page_directory.virt_addr[page_dir_index];
+	
+	if ((page_directory[page_dir_index] & 0x1) || ((kernel_entry & 0x1) == 0))
+	{
+		return FALSE;
+	}
+	
+	page_directory[page_dir_index] = kernel_entry;
+	current_page_directory->tables[page_dir_index] = kernel_page_directory.tables[page_dir_index];
+	
+	invlpg(0xFFC00000 + (page_dir_index << 12));
+	
+	return TRUE;
+}
+
 void copy_page_directory(page_directory_type *source, page_directory_type *dest)
 {
 	for (u32int i = 0; i < 1024; i++)
@@ -10,6 +10,45 @@ u32int kernel_end = (u32int) &end;
 
 bitmap_type *pmm_frames = 0x0;
 
+/*
+ * The buddy allocator is kept as a forest of binary trees, one per 4 MB
+ * chunk of physical memory. Every node holds the largest free order in
+ * its subtree plus one (0 means nothing is free under that node), so an
+ * allocation walks down from the root, and a free walks back up merging
+ * buddies as it goes. A second tree over the chunk roots lets me find a
+ * chunk with a big enough block without looking at every chunk.
+ */
+u8int *pmm_buddy = 0x0;
+u8int *pmm_buddy_top = 0x0;
+u32int pmm_buddy_chunks = 0;
+u32int pmm_buddy_top_leaves = 0;
+u32int pmm_num_frames = 0;
+
+// running counts, so nobody has to scan anything to find out how much memory is left
+u32int pmm_free_frames = 0;
+u32int pmm_reserved_frames = 0;
+
+// the chunk the last allocation came out of. i try it first next time, and
+// only walk the tree over the chunks once it runs out.
+u32int pmm_hint_chunk = 0;
+
+// the first address past everything the physical memory manager keeps for itself
+u32int pmm_metadata_end = 0;
+
+// frames that have already been cleared, so a page fault doesn't have to wait for a 4 KB memset.
+// they're allocated as far as the buddy allocator knows.
+u32int pmm_zero_pool[PMM_ZERO_POOL_SIZE];
+u32int pmm_zero_pool_count = 0;
+
+// a descriptor for every frame up to the last one the memory map says is usable
+page_type *pmm_pages = 0x0;
+u32int pmm_page_frames = 0;
+
+static u8int buddy_combine(u8int left, u8int right, u32int height);
+static void buddy_update_chunk(u8int *tree, u32int node, u32int height);
+static void buddy_update_top(u32int chunk);
+static void buddy_build();
+
 void pmm_initialize(struct multiboot *mboot_ptr)
 {
 	// if the physical memory manager has already been initialized
@@ -38,9 +77,35 @@ void pmm_initialize(struct multiboot *mboot_ptr)
 	// set the size of the bitmap
 	pmm_frames->bytes = bitmap_size;
 	
+	// the summary of the bitmap goes right after it, so searches can skip over whole words at a time
+	u32int summary_size = bitmap_summary_size(bitmap_size);
+	u32int full_addr = (bitmap_addr + bitmap_size + 3) & ~(0x3);
+	u32int empty_addr = full_addr + summary_size;
+	
+	pmm_frames->full = NULL;
+	pmm_frames->empty = NULL;
+	attach_summary(pmm_frames, (u32int *) full_addr, (u32int *) empty_addr);
+	
 	// set everything on the bitmap as being used
 	set_all_bits(pmm_frames);
 	
+	// remember how many frames i'm managing
+	pmm_num_frames = num_frames;
+	
+	// the buddy trees go on the page after the bitmap's summary, with the tree over the chunks right after them
+	pmm_buddy_chunks = (num_frames + PMM_CHUNK_FRAMES - 1) / PMM_CHUNK_FRAMES;
+	
+	pmm_buddy_top_leaves = 1;
+	while (pmm_buddy_top_leaves < pmm_buddy_chunks)
+	{
+		pmm_buddy_top_leaves *= 2;
+	}
+	
+	pmm_buddy = (u8int *) (((empty_addr + summary_size) & ~(0xFFF)) + 0x1000);
+	pmm_buddy_top = pmm_buddy + (pmm_buddy_chunks * PMM_CHUNK_NODES);
+	
+	pmm_metadata_end = (u32int) pmm_buddy_top + (pmm_buddy_top_leaves * 2);
+	
 	// I need to go over the memory map, and figrue out which regions of memory are available for me to use
 	
 	// make a pointer to the start of the memory map.
@@ -52,23 +117,30 @@ void pmm_initialize(struct multiboot *mboot_ptr)
 		// if that entry on the memory map says the memory is free
 		if (mmap->type == 0x1)
 		{
-			// figure out where that region of memory starts
-			u32int region_start = mmap->base_addr_low;
+			// the start and length of the region are 64 bits wide, even though i can only use the first 4 GB
+			u64int region_start = ((u64int) mmap->base_addr_high << 32) | mmap->base_addr_low;
+			u64int region_end = region_start + (((u64int) mmap->length_high << 32) | mmap->length_low);
 			
-			// figure out how many frames are in that region
-			u32int region_frames = mmap->length_low / 0x1000;
+			// only the frames that are completely inside the region are free, so round the start up and the end down
+			u64int first_frame = (region_start + 0xFFF) >> 12;
+			u64int end_frame = region_end >> 12;
 			
-			// for each frame in the region
-			for (u32int i = 0; i < region_frames; i++)
+			// don't go past the end of the bitmap
+			if (end_frame > num_frames)
 			{
-				// figure out the physical address for that frame
-				u32int four_k_frame_addr = region_start + i * 0x1000;
-				
-				// figure out which bit on the bitmap represents the frame
-				u32int bit_on_bitmap = four_k_frame_addr / 0x1000;
+				end_frame = num_frames;
+			}
+			
+			// free the whole run of bits on the bitmap at once
+			if (first_frame < end_frame)
+			{
+				clear_range(pmm_frames, (u32int) first_frame, (u32int) (end_frame - first_frame));
 				
-				// free that bit on the bitmap
-				clear_bit(pmm_frames, bit_on_bitmap);
+				// the frame descriptors only need to go as far as the last usable frame
+				if (end_frame > pmm_page_frames)
+				{
+					pmm_page_frames = (u32int) end_frame;
+				}
 			}
 		}
 		
@@ -87,27 +159,117 @@ void pmm_initialize(struct multiboot *mboot_ptr)
 		// if there's a 4 MB page present
 		if (boot_page_dir[i] & 0x1)
 		{
-			// figure out the physical address for that 4 MB of memory
-			u32int phys_addr = boot_page_dir[i] & ~(0xFFF);
+			// figure out the first frame in that 4 MB of memory
+			u32int first_frame = (boot_page_dir[i] & ~(0xFFF)) / 0x1000;
+			u32int frame_count = 1024;
 			
-			// for each 4 KB page in that 4 MB of memory
-			for (u32int j = 0; j < 1024; j++)
+			// don't go past the end of the bitmap
+			if (first_frame >= num_frames)
 			{
-				// figure out the physical address for that frame
-				u32int four_k_frame_addr = j * 0x1000 + phys_addr;
-				
-				// figure out which bit on the bitmap represents that frame
-				u32int bit_on_bitmap = four_k_frame_addr / 0x1000;
-				// yeah, it's "dumb" but it's correct.
-				
-				// set that bit on the bitmap
-				set_bit(pmm_frames, bit_on_bitmap);
+				continue;
 			}
+			
+			if (first_frame + frame_count > num_frames)
+			{
+				frame_count = num_frames - first_frame;
+			}
+			
+			// set all of the bits for that 4 MB on the bitmap at once
+			set_range(pmm_frames, first_frame, frame_count);
 		}
 	}
+	
+	// now that the bitmap knows what's free i can build the buddy trees from it
+	buddy_build();
+	
+	// whatever isn't free now was never mine to hand out
+	pmm_reserved_frames = pmm_num_frames - pmm_free_frames;
 }
 
+/*
+ * The idle thread fills the zero pool while other threads are allocating, so
+ * everything here that changes the trees, the bitmap, or the pool does it with
+ * interrupts off. That way a thread can't lose the processor half way through.
+ */
+
 u32int alloc_frame()
+{
+	u32int eflags = interrupts_save();
+	
+	u32int result = alloc_frames(0);
+	
+	// if that's everything, a frame that's already been zeroed is still a frame
+	if ((result == 0xFFFFFFFF) && (pmm_zero_pool_count > 0))
+	{
+		result = pmm_zero_pool[--pmm_zero_pool_count];
+		frame_set_owner(result, 0, NULL);
+	}
+	
+	interrupts_restore(eflags);
+	
+	return result;
+}
+
+u32int alloc_zeroed_frame()
+{
+	u32int eflags = interrupts_save();
+	
+	// take one that's already clear if there is one
+	if (pmm_zero_pool_count > 0)
+	{
+		u32int frame = pmm_zero_pool[--pmm_zero_pool_count];
+		frame_set_owner(frame, 0, NULL);
+		interrupts_restore(eflags);
+		return frame;
+	}
+	
+	interrupts_restore(eflags);
+	
+	// otherwise clear one now
+	u32int result = alloc_frames(0);
+	
+	if (result != 0xFFFFFFFF)
+	{
+		zero_frame(result);
+	}
+	
+	return result;
+}
+
+boolean pmm_zero_idle()
+{
+	// clears one frame for the pool, and says whether there's more to do
+	u32int eflags = interrupts_save();
+	
+	if (pmm_zero_pool_count >= PMM_ZERO_POOL_SIZE)
+	{
+		interrupts_restore(eflags);
+		return FALSE;
+	}
+	
+	u32int frame = alloc_frames(0);
+	
+	if (frame == 0xFFFFFFFF)
+	{
+		interrupts_restore(eflags);
+		return FALSE;
+	}
+	
+	zero_frame(frame);
+	frame_set_owner(frame, PMM_PAGE_ZEROED, NULL);
+	pmm_zero_pool[pmm_zero_pool_count++] = frame;
+	
+	interrupts_restore(eflags);
+	
+	return (boolean) (pmm_zero_pool_count < PMM_ZERO_POOL_SIZE);
+}
+
+void free_frame(u32int addr)
+{
+	free_frames(addr, 0);
+}
+
+u32int alloc_frames(u32int order)
 {
 	// i need to make sure the memory manager has been initialized
 	// if the memory manager has not been initialized
@@ -119,31 +281,73 @@ u32int alloc_frame()
 		for (;;) {}
 	}
 	
-	// set up the default return value. if there aren't any free frames
-	// then i'll return 0xFFFF FFFF as an error value. This is because
-	// on a 4GB system it's an invalid memory address.
-	u32int result = 0xFFFFFFFF;
+	u32int eflags = interrupts_save();
 	
-	// if there is a free frame
-	if (any_bit_clear(pmm_frames))
+	// if there isn't a block that big anywhere then i return 0xFFFF FFFF,
+	// because on a 4GB system it's an invalid memory address.
+	if ((order > PMM_MAX_ORDER) || (pmm_buddy_top[1] < order + 1))
 	{
-		// figure out the first free bit on the bitmap.
-		u32int first_clear_bit = find_first_clear_bit(pmm_frames);
-		
-		// set that bit
-		set_bit(pmm_frames, first_clear_bit);
-		
-		// figure out the address for that frame.
-		u32int frame_addr = first_clear_bit * 0x1000;
+		interrupts_restore(eflags);
+		return 0xFFFFFFFF;
+	}
+	
+	u32int chunk = pmm_hint_chunk;
+	u32int node = 1;
+	
+	// if the chunk i used last time can't take it
+	if (pmm_buddy[chunk * PMM_CHUNK_NODES + 1] < order + 1)
+	{
+		// walk down the tree over the chunks to find one that has a big enough block
+		while (node < pmm_buddy_top_leaves)
+		{
+			node *= 2;
+			if (pmm_buddy_top[node] < order + 1)
+			{
+				node++;
+			}
+		}
 		
-		// that's the result
-		result = frame_addr;
+		chunk = node - pmm_buddy_top_leaves;
+		pmm_hint_chunk = chunk;
 	}
 	
-	return result;
+	u8int *tree = &pmm_buddy[chunk * PMM_CHUNK_NODES];
+	
+	// walk down that chunk's tree until i'm at a node the size of the block i want
+	node = 1;
+	for (u32int height = PMM_MAX_ORDER; height > order; height--)
+	{
+		node *= 2;
+		if (tree[node] < order + 1)
+		{
+			node++;
+		}
+	}
+	
+	// take the block, and let everything above it know
+	tree[node] = 0;
+	buddy_update_chunk(tree, node, order);
+	buddy_update_top(chunk);
+	
+	// figure out which frame the block starts on
+	u32int first_frame = (chunk * PMM_CHUNK_FRAMES) + ((node - (PMM_CHUNK_FRAMES >> order)) << order);
+	
+	// keep the bitmap and the counts in step with the trees
+	set_range(pmm_frames, first_frame, 1 << order);
+	pmm_free_frames -= 1 << order;
+	
+	// the first frame of the block remembers how big the block is
+	if ((pmm_pages != NULL) && (first_frame < pmm_page_frames))
+	{
+		pmm_pages[first_frame].order = order;
+	}
+	
+	interrupts_restore(eflags);
+	
+	return first_frame * 0x1000;
 }
 
-void free_frame(u32int addr)
+void free_frames(u32int addr, u32int order)
 {
 	// i need to make sure the memory manager has been initialized
 	// if the memory manager has not been initialized
@@ -155,13 +359,306 @@ void free_frame(u32int addr)
 		for (;;) {}
 	}
 	
-	// sanitize the address to line it up with a frame address
-	u32int aligned_addr = addr & ~(0xFFF);
+	if (order > PMM_MAX_ORDER)
+	{
+		return;
+	}
+	
+	// sanitize the address to line it up with a block of that order
+	u32int first_frame = (addr / 0x1000) & ~((1 << order) - 1);
+	
+	u32int eflags = interrupts_save();
+	
+	// don't touch frames i'm not managing, or blocks that aren't allocated
+	if ((first_frame >= pmm_num_frames) || (!test_bit(pmm_frames, first_frame)))
+	{
+		interrupts_restore(eflags);
+		return;
+	}
+	
+	// figure out which node represents that block
+	u32int chunk = first_frame / PMM_CHUNK_FRAMES;
+	u8int *tree = &pmm_buddy[chunk * PMM_CHUNK_NODES];
+	u32int node = (PMM_CHUNK_FRAMES >> order) + ((first_frame % PMM_CHUNK_FRAMES) >> order);
+	
+	// give the block back, and merge it with its buddies on the way up
+	tree[node] = order + 1;
+	buddy_update_chunk(tree, node, order);
+	buddy_update_top(chunk);
+	
+	// clear the bits on the bitmap
+	clear_range(pmm_frames, first_frame, 1 << order);
+	
+	// and forget everything about the frames
+	if (pmm_pages != NULL)
+	{
+		for (u32int i = first_frame; (i < first_frame + (1 << order)) && (i < pmm_page_frames); i++)
+		{
+			pmm_pages[i].refcount = 0;
+			pmm_pages[i].flags = 0;
+			pmm_pages[i].order = 0;
+			pmm_pages[i].owner = NULL;
+		}
+	}
+	pmm_free_frames += 1 << order;
+	
+	// if the chunk i've been allocating from is used up, start on this one
+	if (pmm_buddy[pmm_hint_chunk * PMM_CHUNK_NODES + 1] == 0)
+	{
+		pmm_hint_chunk = chunk;
+	}
 	
-	// i need to figure out which bit represents that address
-	u32int bit_on_bitmap = aligned_addr / 0x1000;
+	interrupts_restore(eflags);
+}
+
+void pmm_pages_initialize()
+{
+	// the descriptors come out of the kernel heap, so they can't be set up until kmalloc is
+	if (pmm_page_frames > pmm_num_frames)
+	{
+		pmm_page_frames = pmm_num_frames;
+	}
 	
-	// clear the bit on the bitmap
-	clear_bit(pmm_frames, bit_on_bitmap);
+	pmm_pages = (page_type *) kmalloc(pmm_page_frames * sizeof(page_type));
 	
+	if (pmm_pages == NULL)
+	{
+		put_str("\nUnable to allocate the frame descriptors.");
+		put_str("\nHalting.");
+		for (;;) {}
+	}
+	
+	memset((u8int *) pmm_pages, 0, pmm_page_frames * sizeof(page_type));
+	
+	// the page tables that were made before now need to be marked as page tables
+	extern page_directory_type *current_page_directory;
+	u32int *page_directory = current_page_directory->virt_addr;
+	
+	for (u32int i = 0; i < 1023; i++)
+	{
+		if ((page_directory[i] & 0x1) && ((page_directory[i] & PAGE_LARGE) == 0))
+		{
+			frame_set_owner(page_directory[i] & ~(0xFFF), PMM_PAGE_TABLE, current_page_directory);
+		}
+	}
+	
+	// and so do the frames waiting in the zero pool
+	for (u32int i = 0; i < pmm_zero_pool_count; i++)
+	{
+		frame_set_owner(pmm_zero_pool[i], PMM_PAGE_ZEROED, NULL);
+	}
+	
+	// and the slabs that kmem and kmalloc made for themselves, including the one these descriptors might be on
+	extern kmem_cache_type kmem_cache_cache;
+	extern kmem_cache_type *kmalloc_caches[KMALLOC_CLASSES];
+	
+	kmem_cache_tag_slabs(&kmem_cache_cache);
+	
+	for (u32int i = 0; i < KMALLOC_CLASSES; i++)
+	{
+		kmem_cache_tag_slabs(kmalloc_caches[i]);
+	}
+}
+
+page_type *frame_to_page(u32int addr)
+{
+	u32int frame = addr >> 12;
+	
+	if ((pmm_pages == NULL) || (frame >= pmm_page_frames))
+	{
+		return NULL;
+	}
+	
+	return &pmm_pages[frame];
+}
+
+u32int page_to_frame(page_type *page)
+{
+	return (u32int) (page - pmm_pages) << 12;
+}
+
+void frame_set_owner(u32int addr, u8int flags, void *owner)
+{
+	page_type *page = frame_to_page(addr);
+	
+	if (page == NULL)
+	{
+		return;
+	}
+	
+	page->flags = flags;
+	page->owner = owner;
+}
+
+void frame_ref(u32int addr)
+{
+	page_type *page = frame_to_page(addr);
+	
+	if (page == NULL)
+	{
+		return;
+	}
+	
+	// a frame that wasn't shared had one user already, so sharing it makes two
+	if (page->refcount == 0)
+	{
+		page->refcount = 2;
+	}
+	else
+	{
+		page->refcount++;
+	}
+}
+
+u32int frame_unref(u32int addr)
+{
+	page_type *page = frame_to_page(addr);
+	
+	if ((page == NULL) || (page->refcount == 0))
+	{
+		return 0;
+	}
+	
+	page->refcount--;
+	
+	// with one user left it isn't shared any more
+	if (page->refcount == 1)
+	{
+		page->refcount = 0;
+	}
+	
+	return page->refcount;
+}
+
+u32int frame_refcount(u32int addr)
+{
+	page_type *page = frame_to_page(addr);
+	
+	if (page == NULL)
+	{
+		return 0;
+	}
+	
+	return page->refcount;
+}
+
+void pmm_stats(pmm_stats_type *stats)
+{
+	stats->total_frames = pmm_num_frames;
+	stats->free_frames = pmm_free_frames;
+	stats->reserved_frames = pmm_reserved_frames;
+	stats->largest_free_run = 0;
+	stats->zeroed_frames = pmm_zero_pool_count;
+	
+	// walk the runs of clear bits on the bitmap to find the longest one
+	u32int frame = next_clear_from(pmm_frames, 0);
+	
+	while ((frame != 0xFFFFFFFF) && (frame < pmm_num_frames))
+	{
+		u32int run_end = next_set_from(pmm_frames, frame);
+		
+		if ((run_end == 0xFFFFFFFF) || (run_end > pmm_num_frames))
+		{
+			run_end = pmm_num_frames;
+		}
+		
+		if (run_end - frame > stats->largest_free_run)
+		{
+			stats->largest_free_run = run_end - frame;
+		}
+		
+		frame = next_clear_from(pmm_frames, run_end);
+	}
+}
+
+static u8int buddy_combine(u8int left, u8int right, u32int height)
+{
+	// if both halves are completely free, and the whole thing is small enough to be one block, then it's one block
+	if ((height <= PMM_MAX_ORDER) && (left == height) && (right == height))
+	{
+		return height + 1;
+	}
+	
+	// otherwise the best i can do is the bigger of the two halves
+	return (left > right) ? left : right;
+}
+
+static void buddy_update_chunk(u8int *tree, u32int node, u32int height)
+{
+	// climb from the node to the root of the chunk, fixing each parent along the way
+	while (node > 1)
+	{
+		node /= 2;
+		height++;
+		tree[node] = buddy_combine(tree[node * 2], tree[node * 2 + 1], height);
+	}
+}
+
+static void buddy_update_top(u32int chunk)
+{
+	// the leaf for a chunk is the root of that chunk's tree
+	u32int node = pmm_buddy_top_leaves + chunk;
+	pmm_buddy_top[node] = pmm_buddy[chunk * PMM_CHUNK_NODES + 1];
+	
+	// climb to the root, every parent holds the best of its children
+	while (node > 1)
+	{
+		node /= 2;
+		u8int left = pmm_buddy_top[node * 2];
+		u8int right = pmm_buddy_top[node * 2 + 1];
+		pmm_buddy_top[node] = (left > right) ? left : right;
+	}
+}
+
+static void buddy_build()
+{
+	// nothing on the tree over the chunks is free until i say so
+	memset(pmm_buddy_top, 0, pmm_buddy_top_leaves * 2);
+	
+	pmm_free_frames = 0;
+	
+	// the leaves are free wherever the bitmap says a frame is free, so start
+	// with nothing free and then walk the runs of clear bits on the bitmap
+	for (u32int chunk = 0; chunk < pmm_buddy_chunks; chunk++)
+	{
+		memset(&pmm_buddy[chunk * PMM_CHUNK_NODES + PMM_CHUNK_FRAMES], 0, PMM_CHUNK_FRAMES);
+	}
+	
+	u32int frame = next_clear_from(pmm_frames, 0);
+	
+	while ((frame != 0xFFFFFFFF) && (frame < pmm_num_frames))
+	{
+		// figure out where this run of free frames ends
+		u32int run_end = next_set_from(pmm_frames, frame);
+		
+		if ((run_end == 0xFFFFFFFF) || (run_end > pmm_num_frames))
+		{
+			run_end = pmm_num_frames;
+		}
+		
+		pmm_free_frames += run_end - frame;
+		
+		for (; frame < run_end; frame++)
+		{
+			pmm_buddy[(frame / PMM_CHUNK_FRAMES) * PMM_CHUNK_NODES + PMM_CHUNK_FRAMES + (frame % PMM_CHUNK_FRAMES)] = 1;
+		}
+		
+		frame = next_clear_from(pmm_frames, run_end);
+	}
+	
+	for (u32int chunk = 0; chunk < pmm_buddy_chunks; chunk++)
+	{
+		u8int *tree = &pmm_buddy[chunk * PMM_CHUNK_NODES];
+		
+		// fill in the rest of the tree from the bottom up
+		for (u32int height = 1; height <= PMM_MAX_ORDER; height++)
+		{
+			for (u32int node = (PMM_CHUNK_FRAMES >> height); node < (u32int) (PMM_CHUNK_FRAMES >> (height - 1)); node++)
+			{
+				tree[node] = buddy_combine(tree[node * 2], tree[node * 2 + 1], height);
+			}
+		}
+		
+		buddy_update_top(chunk);
+	}
 }
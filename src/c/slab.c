@@ -0,0 +1,252 @@
+#include <slab.h>
+
+extern page_directory_type *current_page_directory;
+
+// the cache that the caches come out of
+kmem_cache_type kmem_cache_cache;
+
+static void kmem_cache_setup(kmem_cache_type *cache, u32int size, u32int align);
+static kmem_slab_type *kmem_slab_create(kmem_cache_type *cache);
+static void kmem_slab_list_tag(kmem_cache_type *cache, list_type *list);
+static void kmem_slab_destroy(kmem_cache_type *cache, kmem_slab_type *slab);
+
+void kmem_initialize()
+{
+	kmem_cache_setup(&kmem_cache_cache, sizeof(kmem_cache_type), sizeof(u32int));
+}
+
+kmem_cache_type *kmem_cache_create(u32int size, u32int align)
+{
+	// an object has to be big enough to hold the pointer to the next free one
+	if (size < sizeof(u32int))
+	{
+		size = sizeof(u32int);
+	}
+	
+	if (align == 0)
+	{
+		align = sizeof(u32int);
+	}
+	
+	// figure out if at least one object will fit on a slab
+	u32int object_size = ((size + align - 1) / align) * align;
+	u32int first_object = ((sizeof(kmem_slab_type) + align - 1) / align) * align;
+	
+	if ((object_size < size) || (first_object + object_size > KMEM_SLAB_SIZE))
+	{
+		return NULL;
+	}
+	
+	kmem_cache_type *cache = (kmem_cache_type *) kmem_cache_alloc(&kmem_cache_cache);
+	
+	if (cache == NULL)
+	{
+		return NULL;
+	}
+	
+	kmem_cache_setup(cache, size, align);
+	
+	return cache;
+}
+
+u32int *kmem_cache_alloc(kmem_cache_type *cache)
+{
+	kmem_slab_type *slab;
+	
+	// use a slab that's partly used if there is one, then an empty one, and only make a new one if i have to
+	if (cache->partial.first != NULL)
+	{
+		slab = (kmem_slab_type *) cache->partial.first->data;
+	}
+	else if (cache->empty.first != NULL)
+	{
+		slab = (kmem_slab_type *) cache->empty.first->data;
+		remove(&cache->empty, &slab->node);
+		insert_first(&cache->partial, &slab->node);
+	}
+	else
+	{
+		slab = kmem_slab_create(cache);
+		
+		if (slab == NULL)
+		{
+			return NULL;
+		}
+		
+		insert_first(&cache->partial, &slab->node);
+	}
+	
+	// take the first object off the slab's free list
+	u32int *object = slab->free_objects;
+	slab->free_objects = (u32int *) *object;
+	slab->in_use++;
+	cache->objects_in_use++;
+	
+	// if that was the last one, the slab is full
+	if (slab->in_use == cache->objects_per_slab)
+	{
+		remove(&cache->partial, &slab->node);
+		insert_first(&cache->full, &slab->node);
+	}
+	
+	return object;
+}
+
+void kmem_cache_free(kmem_cache_type *cache, u32int *object)
+{
+	if (object == NULL)
+	{
+		return;
+	}
+	
+	// the slab header is at the start of the page the object is on
+	kmem_slab_type *slab = (kmem_slab_type *) ((u32int) object & ~(KMEM_SLAB_SIZE - 1));
+	
+	if (slab->cache != cache)
+	{
+		put_str("\nObject ");
+		put_hex((u32int) object);
+		put_str(" was freed to a cache it didn't come from.");
+		put_str("\nHalting.");
+		for (;;) {}
+	}
+	
+	// if the slab was full it's going to be partly used
+	if (slab->in_use == cache->objects_per_slab)
+	{
+		remove(&cache->full, &slab->node);
+		insert_first(&cache->partial, &slab->node);
+	}
+	
+	// put the object back on the slab's free list
+	*object = (u32int) slab->free_objects;
+	slab->free_objects = object;
+	slab->in_use--;
+	cache->objects_in_use--;
+	
+	// if the slab is empty now
+	if (slab->in_use == 0)
+	{
+		remove(&cache->partial, &slab->node);
+		
+		// keep one empty slab around so a cache going back and forth doesn't keep mapping and unmapping a page
+		if (cache->empty.first == NULL)
+		{
+			insert_first(&cache->empty, &slab->node);
+		}
+		else
+		{
+			kmem_slab_destroy(cache, slab);
+		}
+	}
+}
+
+void kmem_print_cache(kmem_cache_type *cache)
+{
+	put_str("\ncache=");
+	put_hex((u32int) cache);
+	
+	put_str(" object_size=");
+	put_dec(cache->object_size);
+	
+	put_str(" slabs=");
+	put_dec(cache->slabs);
+	
+	put_str(" objects_in_use=");
+	put_dec(cache->objects_in_use);
+	
+	put_str(" objects_per_slab=");
+	put_dec(cache->objects_per_slab);
+}
+
+// the slabs made before the frame descriptors existed never got marked, so this goes back over them
+void kmem_cache_tag_slabs(kmem_cache_type *cache)
+{
+	kmem_slab_list_tag(cache, &cache->partial);
+	kmem_slab_list_tag(cache, &cache->full);
+	kmem_slab_list_tag(cache, &cache->empty);
+}
+
+static void kmem_cache_setup(kmem_cache_type *cache, u32int size, u32int align)
+{
+	cache->object_size = ((size + align - 1) / align) * align;
+	cache->align = align;
+	cache->first_object = ((sizeof(kmem_slab_type) + align - 1) / align) * align;
+	cache->objects_per_slab = (KMEM_SLAB_SIZE - cache->first_object) / cache->object_size;
+	
+	cache->partial.first = NULL;
+	cache->partial.last = NULL;
+	cache->full.first = NULL;
+	cache->full.last = NULL;
+	cache->empty.first = NULL;
+	cache->empty.last = NULL;
+	
+	cache->slabs = 0;
+	cache->objects_in_use = 0;
+}
+
+static kmem_slab_type *kmem_slab_create(kmem_cache_type *cache)
+{
+	// get a page of address space, and put a frame behind it right away
+	u32int slab_addr = (u32int) malloc_above(KMEM_SLAB_SIZE, KMEM_SLAB_SIZE, VMM_KERNEL_START);
+	
+	if (slab_addr == NULL)
+	{
+		return NULL;
+	}
+	
+	u32int phys_addr = alloc_frame();
+	
+	if (phys_addr == 0xFFFFFFFF)
+	{
+		free((u32int *) slab_addr);
+		return NULL;
+	}
+	
+	map_page(slab_addr, phys_addr, PAGE_KERNEL);
+	frame_set_owner(phys_addr, PMM_PAGE_SLAB, cache);
+	
+	kmem_slab_type *slab = (kmem_slab_type *) slab_addr;
+	
+	slab->node.prev = NULL;
+	slab->node.next = NULL;
+	slab->node.data = slab;
+	slab->cache = cache;
+	slab->in_use = 0;
+	
+	// chain all the objects together on the free list, lowest address first
+	slab->free_objects = NULL;
+	
+	for (u32int i = cache->objects_per_slab; i > 0; i--)
+	{
+		u32int *object = (u32int *) (slab_addr + cache->first_object + ((i - 1) * cache->object_size));
+		*object = (u32int) slab->free_objects;
+		slab->free_objects = object;
+	}
+	
+	cache->slabs++;
+	
+	return slab;
+}
+
+static void kmem_slab_destroy(kmem_cache_type *cache, kmem_slab_type *slab)
+{
+	// give the frame back to the physical memory manager, and the page back to the virtual memory manager
+	u32int slab_addr = (u32int) slab;
+	u32int phys_addr = virt_to_phys(current_page_directory, slab_addr);
+	
+	unmap_page(slab_addr);
+	free_frame(phys_addr);
+	free((u32int *) slab_addr);
+	
+	cache->slabs--;
+}
+
+static void kmem_slab_list_tag(kmem_cache_type *cache, list_type *list)
+{
+	for (list_node_type *node = list->first; node != NULL; node = node->next)
+	{
+		u32int phys_addr = virt_to_phys(current_page_directory, (u32int) node->data);
+		frame_set_owner(phys_addr, PMM_PAGE_SLAB, cache);
+	}
+}
@@ -1 +1,394 @@
 #include <task.h>
+
+// the thread that's running now, and the one that runs when nothing else can
+task_type *current_task = NULL;
+task_type *idle_task = NULL;
+
+// threads waiting for a turn, a queue for each priority. each one's in the order they'll get it.
+list_type task_ready[TASK_PRIORITIES];
+
+// a bit for each queue that has something on it
+u32int task_ready_map = 0;
+
+// set when a thread gets woken up that's more important than the one that's running
+boolean task_need_resched = FALSE;
+
+// threads that have finished. the next thread that gets created uses one's control block and stack.
+list_type task_dead;
+
+// every thread there's ever been, newest first
+task_type *task_all = NULL;
+
+kmem_cache_type *task_cache = NULL;
+u32int task_next_id = 0;
+
+static void schedule();
+static void task_start();
+
+static void task_enqueue(task_type *task)
+{
+	insert_last(&task_ready[task->dynamic], &task->node);
+	task_ready_map |= (u32int) 1 << task->dynamic;
+}
+
+static task_type *task_dequeue()
+{
+	// the lowest set bit is the most important queue with anything on it
+	if (task_ready_map == 0)
+	{
+		return NULL;
+	}
+	
+	u32int priority = __builtin_ctz(task_ready_map);
+	list_node_type *node = task_ready[priority].first;
+	
+	remove(&task_ready[priority], node);
+	
+	if (task_ready[priority].first == NULL)
+	{
+		task_ready_map &= ~((u32int) 1 << priority);
+	}
+	
+	return (task_type *) node->data;
+}
+
+static boolean task_ready_at(u32int priority)
+{
+	// says whether anything at least that important is waiting
+	return (boolean) ((task_ready_map & (((u32int) 2 << priority) - 1)) != 0);
+}
+
+void task_initialize()
+{
+	task_cache = kmem_cache_create(sizeof(task_type), 4);
+	
+	// whatever's running now becomes the idle thread. it already has a stack, the one the kernel booted on.
+	idle_task = (task_type *) kmem_cache_alloc(task_cache);
+	
+	if (idle_task == NULL)
+	{
+		put_str("\nUnable to create the idle thread.");
+		put_str("\nHalting.");
+		for (;;) {}
+	}
+	
+	idle_task->esp = 0;
+	idle_task->id = task_next_id++;
+	idle_task->state = TASK_RUNNING;
+	idle_task->priority = TASK_PRIORITIES - 1;
+	idle_task->dynamic = TASK_PRIORITIES - 1;
+	idle_task->ticks_left = 0;
+	idle_task->stack = NULL;
+	idle_task->entry = NULL;
+	idle_task->name = "idle";
+	idle_task->node.data = idle_task;
+	idle_task->all_next = task_all;
+	task_all = idle_task;
+	
+	current_task = idle_task;
+}
+
+task_type *task_create(char *name, void (*entry)(), u32int priority)
+{
+	if (priority >= TASK_PRIORITIES)
+	{
+		priority = TASK_PRIORITIES - 1;
+	}
+	
+	task_type *task = NULL;
+	
+	// use a finished thread's control block and stack if there is one
+	u32int eflags = interrupts_save();
+	
+	if (task_dead.first != NULL)
+	{
+		task = (task_type *) task_dead.first->data;
+		remove(&task_dead, task_dead.first);
+	}
+	
+	interrupts_restore(eflags);
+	
+	if (task == NULL)
+	{
+		task = (task_type *) kmem_cache_alloc(task_cache);
+		
+		if (task == NULL)
+		{
+			return NULL;
+		}
+		
+		task->stack = kmalloc(TASK_STACK_SIZE);
+		
+		if (task->stack == NULL)
+		{
+			kmem_cache_free(task_cache, (u32int *) task);
+			return NULL;
+		}
+		
+		task->node.data = task;
+		
+		eflags = interrupts_save();
+		task->all_next = task_all;
+		task_all = task;
+		interrupts_restore(eflags);
+	}
+	
+	// two threads making threads at once can't be allowed to hand out the same id
+	eflags = interrupts_save();
+	task->id = task_next_id++;
+	interrupts_restore(eflags);
+	
+	task->priority = priority;
+	task->dynamic = priority;
+	task->ticks_left = task_time_slice(priority);
+	task->entry = entry;
+	task->name = name;
+	
+	// set the stack up the way switch_task leaves one, so switching to it pops zeroes
+	// in to the registers and returns in to task_start
+	u32int *stack_top = (u32int *) ((u32int) task->stack + TASK_STACK_SIZE);
+	
+	*--stack_top = 0;	// task_start never returns, but it gets somewhere to return to anyway
+	*--stack_top = (u32int) &task_start;
+	*--stack_top = 0;	// ebp
+	*--stack_top = 0;	// ebx
+	*--stack_top = 0;	// esi
+	*--stack_top = 0;	// edi
+	
+	task->esp = (u32int) stack_top;
+	
+	eflags = interrupts_save();
+	task->state = TASK_READY;
+	task_enqueue(task);
+	
+	if ((current_task != NULL) && (priority < current_task->dynamic))
+	{
+		task_need_resched = TRUE;
+	}
+	
+	interrupts_restore(eflags);
+	
+	return task;
+}
+
+static void task_start()
+{
+	// every thread gets here from inside schedule, and that's always done with interrupts off
+	enable_interrupts();
+	
+	current_task->entry();
+	
+	task_exit();
+}
+
+void task_exit()
+{
+	disable_interrupts();
+	
+	current_task->state = TASK_DEAD;
+	insert_last(&task_dead, &current_task->node);
+	
+	schedule();
+	
+	// nothing ever switches back to a dead thread
+	for (;;) {}
+}
+
+static void schedule()
+{
+	// this has to be called with interrupts off
+	task_type *prev = current_task;
+	
+	// the thread that was running goes to the back of its queue, unless it's blocked, finished, or idle.
+	// if something more important took over, it gets the rest of its turn when it comes back.
+	if (prev->state == TASK_RUNNING)
+	{
+		prev->state = TASK_READY;
+		
+		if (prev != idle_task)
+		{
+			task_enqueue(prev);
+		}
+	}
+	
+	// the idle thread only gets a turn when nobody else wants one
+	task_type *next = task_dequeue();
+	
+	if (next == NULL)
+	{
+		next = idle_task;
+	}
+	
+	if (next->ticks_left == 0)
+	{
+		next->ticks_left = task_time_slice(next->dynamic);
+	}
+	
+	next->state = TASK_RUNNING;
+	current_task = next;
+	task_need_resched = FALSE;
+	
+	// if the idle thread had the timer slowed down, a real thread needs it ticking again
+	if (next != idle_task)
+	{
+		timer_start_tick();
+	}
+	
+	if (next != prev)
+	{
+		switch_task(&prev->esp, next->esp);
+	}
+}
+
+void task_yield()
+{
+	if (current_task == NULL)
+	{
+		return;
+	}
+	
+	u32int eflags = interrupts_save();
+	schedule();
+	interrupts_restore(eflags);
+}
+
+void task_block(list_type *wait_list)
+{
+	// interrupts have to be off from when the caller decides to wait until it's on the list,
+	// otherwise the wake up it's waiting for could come in between and get missed
+	
+	// giving up the processor before the turn's over looks like waiting on input, so it moves up a priority
+	if ((current_task->ticks_left > 0) && (current_task->dynamic > 0)
+		&& (current_task->dynamic + TASK_BOOST_MAX > current_task->priority))
+	{
+		current_task->dynamic--;
+	}
+	
+	current_task->state = TASK_BLOCKED;
+	insert_last(wait_list, &current_task->node);
+	
+	schedule();
+}
+
+void task_wake(list_type *wait_list)
+{
+	u32int eflags = interrupts_save();
+	
+	// everything that was waiting goes on the ready queues, with a fresh turn
+	while (wait_list->first != NULL)
+	{
+		list_node_type *node = wait_list->first;
+		remove(wait_list, node);
+		
+		task_type *task = (task_type *) node->data;
+		task->state = TASK_READY;
+		task->ticks_left = task_time_slice(task->dynamic);
+		task_enqueue(task);
+		
+		// if it's more important than what's running, it shouldn't have to wait for the next tick
+		if ((current_task != NULL) && ((current_task == idle_task) || (task->dynamic < current_task->dynamic)))
+		{
+			task_need_resched = TRUE;
+		}
+	}
+	
+	interrupts_restore(eflags);
+	
+	// interrupt handlers get switched out of by task_preempt, but a thread that could have been
+	// interrupted anyway can switch right here
+	if ((eflags & 0x200) && (task_need_resched))
+	{
+		task_yield();
+	}
+}
+
+void task_tick()
+{
+	// the timer gets here with interrupts off, before there might be any threads
+	if (current_task == NULL)
+	{
+		return;
+	}
+	
+	// the idle thread gives way as soon as there's somebody else
+	if (current_task == idle_task)
+	{
+		if (task_ready_map != 0)
+		{
+			schedule();
+		}
+		return;
+	}
+	
+	if (current_task->ticks_left > 0)
+	{
+		current_task->ticks_left--;
+	}
+	
+	if (current_task->ticks_left > 0)
+	{
+		return;
+	}
+	
+	// using the whole turn looks like being busy with the processor, so it moves down a priority
+	if ((current_task->dynamic < TASK_PRIORITIES - 1) && (current_task->dynamic < current_task->priority + TASK_BOOST_MAX))
+	{
+		current_task->dynamic++;
+	}
+	
+	// if nobody as important is waiting the thread can just have another turn
+	if (task_ready_at(current_task->dynamic))
+	{
+		schedule();
+	}
+	else
+	{
+		current_task->ticks_left = task_time_slice(current_task->dynamic);
+	}
+}
+
+void task_preempt()
+{
+	// called on the way out of an IRQ, in case the handler woke somebody more important up
+	if ((current_task != NULL) && (task_need_resched))
+	{
+		schedule();
+	}
+}
+
+void task_halt()
+{
+	// if nothing else wants to run, sleep until an interrupt comes in. sti doesn't take effect
+	// until after the next instruction, so nothing can get in between checking and halting.
+	// there's nobody to take turns with, so the timer doesn't need to tick while it's asleep.
+	disable_interrupts();
+	
+	if (task_ready_map == 0)
+	{
+		timer_stop_tick();
+		asm volatile ("sti\n\thlt" : : : "memory");
+	}
+	
+	enable_interrupts();
+}
+
+void task_print_list()
+{
+	char *states[] = { "ready", "running", "blocked", "dead" };
+	
+	for (task_type *task = task_all; task != NULL; task = task->all_next)
+	{
+		put_str("\n");
+		put_dec(task->id);
+		put_str(" ");
+		put_str(task->name);
+		put_str(" (");
+		put_str(states[task->state]);
+		put_str(") priority ");
+		put_dec(task->dynamic);
+		put_str(" of ");
+		put_dec(task->priority);
+	}
+	
+	put_str("\n");
+}
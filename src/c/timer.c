@@ -2,22 +2,190 @@
 
 static u32int tick = 0;
 
+// how many PIT counts make one tick, and the counts that have gone by since the last whole tick
+static u32int timer_counts_per_tick = 0;
+static u32int timer_remainder = 0;
+
+// every count the PIT has been through since it was started
+static u64int timer_counts_total = 0;
+
+// what the PIT counts down from each time round
+static u32int timer_period = 0;
+
+// TRUE when the PIT ran out while it was being set up again. that interrupt's counts were already
+// taken care of, so the handler leaves it alone.
+static boolean timer_stale = FALSE;
+
+// TRUE while the idle thread is asleep, and the timer only goes off as often as it has to
+static boolean timer_tickless = FALSE;
+
+/*
+ * The PIT runs as a rate generator, so it starts over by itself every time it
+ * gets to the end, and the interrupt handler never has to touch it. That way no
+ * counts get lost while threads are running. It only gets set up again when the
+ * idle thread goes to sleep, to count as long as it can, and when a thread is
+ * about to run again, to go back to one tick at a time. The tick count is worked
+ * out from how many counts the PIT has been through, so it keeps time the same
+ * either way.
+ */
+
+static void timer_program(u32int counts)
+{
+	// channel 0, low byte then high byte, mode 2 (rate generator). a count of 0 means 0x10000.
+	outb(0x43, 0x34);
+	outb(0x40, (counts & 0xFF));
+	outb(0x40, ((counts >> 8) & 0xFF));
+	
+	timer_period = counts;
+}
+
+static u32int timer_irq_pending()
+{
+	// ask the master PIC for its interrupt request register. IRQ0 is bit 0.
+	outb(0x20, 0x0A);
+	return inb(0x20) & 0x1;
+}
+
+static u32int timer_elapsed()
+{
+	u32int pending;
+	u32int current;
+	
+	// if the PIT gets to the end while the count's being read, the PIC won't say the same thing
+	// before and after, so it gets read again
+	do
+	{
+		pending = timer_irq_pending();
+		
+		// latch channel 0's count so both bytes come from the same moment
+		outb(0x43, 0x00);
+		current = inb(0x40);
+		current |= inb(0x40) << 8;
+	} while (pending != timer_irq_pending());
+	
+	// it counts down from the period to 1, and a period of 0x10000 reads as 0 when it starts
+	if (current == 0)
+	{
+		current = 0x10000;
+	}
+	
+	// if it already went off and the handler hasn't got to it yet, a whole period is waiting to be counted
+	if ((pending) && (!timer_stale))
+	{
+		return timer_period + (timer_period - current);
+	}
+	
+	return timer_period - current;
+}
+
+static void timer_account(u32int counts)
+{
+	timer_counts_total += counts;
+	timer_remainder += counts;
+	
+	while (timer_remainder >= timer_counts_per_tick)
+	{
+		timer_remainder -= timer_counts_per_tick;
+		tick++;
+	}
+}
+
+static void timer_restart(u32int counts)
+{
+	// count everything up to now, plus what goes by while the PIT's being set up again
+	u32int elapsed = timer_elapsed();
+	
+	timer_program(counts);
+	
+	// anything the PIC's holding on to now came from the old count, which just got counted
+	timer_stale = (boolean) timer_irq_pending();
+	
+	timer_account(elapsed + TIMER_REPROGRAM_COUNTS);
+}
+
 void timer_initialize(u32int freq)
 {
 	register_interrupt_handler(IRQ0, &timer_interrupt_handler);
 	
-	u32int divisor = 1193180 / freq;
-	outb(0x43, 0x36);
-	outb(0x40, (divisor & 0xFF));
-	outb(0x40, ((divisor >> 8) & 0xFF));
+	timer_counts_per_tick = PIT_FREQUENCY / freq;
+	
+	timer_program(timer_counts_per_tick);
+}
+
+void timer_interrupt_handler(__attribute__ ((unused)) registers *regs)
+{
+	// the PIT has already started the next period by itself
+	if (timer_stale)
+	{
+		timer_stale = FALSE;
+	}
+	else
+	{
+		timer_account(timer_period);
+	}
+	
+	// the running thread might have used up its turn
+	task_tick();
+}
+
+void timer_stop_tick()
+{
+	// the idle thread is about to halt, so the timer only has to keep time
+	u32int eflags = interrupts_save();
+	
+	if (!timer_tickless)
+	{
+		timer_restart(TIMER_IDLE_COUNTS);
+		timer_tickless = TRUE;
+	}
+	
+	interrupts_restore(eflags);
 }
 
-void timer_interrupt_handler(__attribute__ ((unused)) registers regs)
+void timer_start_tick()
 {
-	tick++;
+	// a thread's about to run, and it needs ticks to know when its turn is up
+	u32int eflags = interrupts_save();
+	
+	if (timer_tickless)
+	{
+		timer_restart(timer_counts_per_tick);
+		timer_tickless = FALSE;
+	}
+	
+	interrupts_restore(eflags);
+}
+
+u64int timer_read_counts()
+{
+	// the clock falls back on this when there's no TSC
+	u32int eflags = interrupts_save();
+	
+	u64int result = timer_counts_total;
+	
+	if (timer_counts_per_tick != 0)
+	{
+		result += timer_elapsed();
+	}
+	
+	interrupts_restore(eflags);
+	
+	return result;
 }
 
 u32int get_tick()
 {
-	return tick;
+	// whole ticks so far, plus whatever the PIT's been through since it last went off
+	u32int eflags = interrupts_save();
+	
+	u32int result = tick;
+	
+	if (timer_counts_per_tick != 0)
+	{
+		result += (timer_remainder + timer_elapsed()) / timer_counts_per_tick;
+	}
+	
+	interrupts_restore(eflags);
+	
+	return result;
 }
@@ -26,6 +26,9 @@ void put_char(char c)
 	u16int *index_ptr;
 	u16int my_attrib = attrib << 8;
 	
+	// the terminal and the vga thread both write to the screen, so the cursor can't change half way through
+	u32int eflags = interrupts_save();
+	
 	if (c == 0x08) // backspace
 	{
 		if (csr_x != 0)
@@ -64,6 +67,8 @@ void put_char(char c)
 
 	scroll();
 	move_csr();
+	
+	interrupts_restore(eflags);
 }
 
 void scroll()
@@ -210,10 +215,19 @@ void clear_line()
 // the kernel will occationally flush the buffer to the screen.
 // in this way i won't have crap crashing the system by trying to write to the screen while an interrupt is running
 
-static u8int vga_buffer[VGA_BUFFER_SIZE];
+// there are two buffers. one gets filled while the vga thread draws the other, and they get swapped
+// when it comes back for more. only the vga thread ever empties one, so text goes out in order.
+static u8int vga_buffers[2][VGA_BUFFER_SIZE];
+static u8int *vga_buffer = vga_buffers[0];
 static u16int vga_buffer_length = 0;
 static void (*vga_handler)(u8int *buf, u16int size) = NULL;
 
+// threads waiting for something to be put on the buffer
+static list_type vga_waiting;
+
+// threads waiting for room on the buffer
+static list_type vga_room;
+
 // this sets the callback function on the kernel that actually takes care of business from kernel space
 void vga_set_handler(void (*callback)(u8int *buf, u16int size))
 {
@@ -223,27 +237,79 @@ void vga_set_handler(void (*callback)(u8int *buf, u16int size))
 // calling this function will cause whwatever's in the buffer to be put on the screen, and clear the buffer
 void vga_flush()
 {
-	if (vga_buffer_length > 0)
+	// swap the buffers with interrupts off, then draw the full one with them back on.
+	// put_char looks after the cursor by itself.
+	u32int eflags = interrupts_save();
+	
+	u8int *full_buffer = vga_buffer;
+	u16int length = vga_buffer_length;
+	
+	if (length > 0)
 	{
-		//disable_interrupts(); // i don't think writing to the screen should be an issue
-		if (vga_handler != NULL)
-		{
-			vga_handler(vga_buffer, vga_buffer_length);
-		}
+		vga_buffer = (vga_buffer == vga_buffers[0]) ? vga_buffers[1] : vga_buffers[0];
 		vga_buffer_length = 0;
-		//enable_interrupts();
+		task_wake(&vga_room);
+	}
+	
+	interrupts_restore(eflags);
+	
+	if ((length > 0) && (vga_handler != NULL))
+	{
+		vga_handler(full_buffer, length);
 	}
 }
 
-void vga_buffer_put_char(char c)
+void vga_wait()
 {
-	vga_buffer[vga_buffer_length++] = c;
-	if (vga_buffer_length == VGA_BUFFER_SIZE)
+	// blocks the thread until there's something on the buffer
+	u32int eflags = interrupts_save();
+	
+	if (vga_buffer_length == 0)
 	{
+		task_block(&vga_waiting);
+	}
+	
+	interrupts_restore(eflags);
+}
+
+void vga_thread()
+{
+	// puts whatever gets buffered on the screen, and sleeps the rest of the time
+	for (;;)
+	{
+		vga_wait();
 		vga_flush();
 	}
 }
 
+void vga_buffer_put_char(char c)
+{
+	extern task_type *current_task;
+	
+	u32int eflags = interrupts_save();
+	
+	// if the buffer's full, the vga thread gets woken up to swap it out, and this one waits until it has.
+	// before there are any threads there's nobody to wait for, so it just gets drawn right here.
+	while (vga_buffer_length == VGA_BUFFER_SIZE)
+	{
+		if (current_task == NULL)
+		{
+			vga_flush();
+		}
+		else
+		{
+			task_wake(&vga_waiting);
+			task_block(&vga_room);
+		}
+	}
+	
+	vga_buffer[vga_buffer_length++] = c;
+	
+	interrupts_restore(eflags);
+	
+	task_wake(&vga_waiting);
+}
+
 void vga_buffer_put_str(char *str)
 {
 	int i = 0;
@@ -4,7 +4,41 @@ extern page_directory_type *current_page_directory;
 
 list_type *vmm_unused_nodes;
 list_type *vmm_used;
-list_type *vmm_free;
+
+// the free regions, one list for each size class, and a bit for each class that has anything on it
+list_type vmm_free_classes[VMM_FREE_CLASSES];
+u32int vmm_free_class_map = 0;
+
+// the root of the tree of regions, sorted by virtual address
+vmm_data_type *vmm_root = NULL;
+
+// where the next brand new node will go, and how much of the node arena has frames behind it
+u32int vmm_node_top = 0;
+u32int vmm_node_mapped_end = 0;
+
+// how many nodes have ever been made, and how many of them are on the unused list
+u32int vmm_nodes_created = 0;
+u32int vmm_nodes_unused = 0;
+
+static u32int size_class(u32int size);
+static void free_class_insert(list_node_type *node);
+static void free_class_remove(list_node_type *node);
+static u32int fit_addr(vmm_data_type *data, u32int size, u32int align, u32int above);
+static void vmm_node_arena_grow(u32int end_addr);
+static void vmm_extend_run(u32int *run_start, u32int *run_size, u32int virt_addr, u32int size);
+static u32int tree_height(vmm_data_type *data);
+static void tree_update(vmm_data_type *data);
+static void tree_refresh(vmm_data_type *data);
+static void tree_replace_child(vmm_data_type *parent, vmm_data_type *old_child, vmm_data_type *new_child);
+static vmm_data_type *tree_rotate_left(vmm_data_type *data);
+static vmm_data_type *tree_rotate_right(vmm_data_type *data);
+static void tree_rebalance(vmm_data_type *data);
+static void tree_insert(vmm_data_type *data);
+static void tree_remove(vmm_data_type *data);
+static vmm_data_type *tree_find(u32int virt_addr);
+static vmm_data_type *tree_next(vmm_data_type *data);
+static vmm_data_type *tree_prev(vmm_data_type *data);
+static vmm_data_type *tree_search_fit(vmm_data_type *data, u32int size, u32int align, u32int above);
 
 void vmm_initialize()
 {
@@ -12,12 +46,18 @@ void vmm_initialize()
 	u32int *page_directory = current_page_directory->virt_addr;
 	
 	// create a pointer to the place where the lists will start
-	u32int vmm_starting_addr = 0xC0400000;
+	u32int vmm_starting_addr = VMM_NODE_START;
+	
+	// put a frame behind the start of the node arena before i write anything there
+	vmm_node_mapped_end = VMM_NODE_START;
+	vmm_node_arena_grow(vmm_starting_addr + (sizeof(list_type) * 2));
 	
 	// set up the pointers for the lists
 	vmm_unused_nodes = (list_type *) vmm_starting_addr;
 	vmm_used = (list_type *) ((u32int) vmm_unused_nodes + sizeof(list_type));
-	vmm_free = (list_type *) ((u32int) vmm_used + sizeof(list_type));
+	
+	// the nodes go right after the lists
+	vmm_node_top = (u32int) vmm_used + sizeof(list_type);
 	
 	// clear the lists
 	vmm_unused_nodes->first = NULL;
@@ -26,30 +66,55 @@ void vmm_initialize()
 	vmm_used->first = NULL;
 	vmm_used->last = NULL;
 	
-	vmm_free->first = NULL;
-	vmm_free->last = NULL;
+	for (u32int i = 0; i < VMM_FREE_CLASSES; i++)
+	{
+		vmm_free_classes[i].first = NULL;
+		vmm_free_classes[i].last = NULL;
+	}
+	
+	vmm_free_class_map = 0;
+	vmm_root = NULL;
+	
+	// free pages next to each other are gathered up in to one run, and the run is
+	// only put on the free lists when it ends, so each run is one add_free
+	u32int run_start = 0;
+	u32int run_size = 0;
 	
 	// for each item on the page directory (except the last 4 MB where the recursive mappings are)
 	for (u32int i = 0; i < 1023; i++)
 	{
+		// the 4 MB where the nodes live is never free
+		if (i == (VMM_NODE_START >> 22))
+		{
+			continue;
+		}
+		
+		// neither is the temporary mapping window
+		if (i == (KMAP_WINDOW_START >> 22))
+		{
+			continue;
+		}
+		
+		// a 4 MB page is used all the way through, and it doesn't have a page table to look at
+		if (page_directory[i] & PAGE_LARGE)
+		{
+			continue;
+		}
+		
 		// if there's nothing on that index
 		if ((page_directory[i] & 0x1) == 0)
 		{
-			// get a new node
-			list_node_type *new_node = get_unused_node();
-			
-			// make a pointer to the new node data
-			vmm_data_type *new_data = (vmm_data_type *) new_node->data;
-			
-			// populate the data
-			new_data->virt_addr = i * 0x400000;
-			new_data->size = 0x400000;
-			
-			// put the node on the list
-			insert_last(vmm_free, new_node);
-			
-			// compact the list
-			compact_all_free();
+			// add the region to the run
+			if (i == 0)
+			{
+				// leave the first page out so malloc never hands out NULL
+				run_start = 0x1000;
+				run_size = 0x400000 - 0x1000;
+			}
+			else
+			{
+				vmm_extend_run(&run_start, &run_size, i * 0x400000, 0x400000);
+			}
 		}
 		else
 		{
@@ -65,27 +130,20 @@ void vmm_initialize()
 			for (u32int j = 0; j < 1024; j++)
 			{
 				// if there's nothing on that index
-				if ((page_table[j] & 0x1) == 0)
+				if (((page_table[j] & 0x1) == 0) && ((i != 0) || (j != 0)))
 				{
-					// get a new node
-					list_node_type *new_node = get_unused_node();
-					
-					// make a pointer to the new node data
-					vmm_data_type *new_data = (vmm_data_type *) new_node->data;
-					
-					// populate the data
-					new_data->virt_addr = ((i * 0x400000) + (j * 0x1000));
-					new_data->size = 0x1000;
-					
-					// put the node on the list
-					insert_last(vmm_free, new_node);
-					
-					// compact the list
-					compact_all_free();
+					// add the page to the run
+					vmm_extend_run(&run_start, &run_size, (i * 0x400000) + (j * 0x1000), 0x1000);
 				}
 			}
 		}
 	}
+	
+	// and put the last run on
+	if (run_size != 0)
+	{
+		add_free(run_start, run_size);
+	}
 }
 
 u32int *malloc(u32int size)
@@ -100,41 +158,57 @@ u32int *malloc_align(u32int size, u32int align)
 
 u32int *malloc_above(u32int size, u32int align, u32int above)
 {
-	list_node_type *malloc_node = search_free((size + align), above);
-	
-	vmm_data_type *malloc_data = malloc_node->data;
-	
-	u32int start_addr = malloc_data->virt_addr;
-	u32int split_size = 0;
-	
-	while (start_addr < above)
+	if (size == 0)
 	{
-		start_addr++;
-		split_size++;
+		size = 1;
 	}
 	
-	while (start_addr % align != 0)
+	if (align == 0)
 	{
-		start_addr++;
-		split_size++;
+		align = 1;
 	}
 	
-	if (split_size > 0)
+	// find a free region that can hold the allocation
+	list_node_type *malloc_node = search_free(size, align, above);
+	
+	if (malloc_node == NULL)
 	{
-		malloc_node = split_free(malloc_node, size);
-		malloc_node = malloc_node->next;
+		return NULL;
 	}
 	
-	list_node_type *split_node = split_free(malloc_node, size);
+	vmm_data_type *malloc_data = (vmm_data_type *) malloc_node->data;
+	
+	// figure out where in the region the allocation goes
+	u32int start_addr = fit_addr(malloc_data, size, align, above);
+	
+	// the region is going to change size, so take it off its free list
+	free_class_remove(malloc_node);
 	
-	remove(vmm_free, split_node);
+	// if the allocation doesn't start at the beginning of the region
+	if (start_addr > malloc_data->virt_addr)
+	{
+		// split the front of the region off, and leave it free
+		split_free(malloc_node, start_addr - malloc_data->virt_addr);
+		free_class_insert(malloc_node);
+		
+		// carry on with the part that was split off
+		malloc_data = tree_next(malloc_data);
+		malloc_node = malloc_data->node;
+		free_class_remove(malloc_node);
+	}
 	
-	insert_last(vmm_used, split_node);
+	// split whatever's left over after the allocation off, and leave it free
+	if (malloc_data->size > size)
+	{
+		split_free(malloc_node, size);
+	}
 	
-	vmm_data_type *malloc_node_data = (vmm_data_type *) malloc_node->data;
-	u32int *malloc_ptr = (u32int *) malloc_node_data->virt_addr;
+	// the region is used now
+	malloc_data->free = FALSE;
+	tree_refresh(malloc_data);
+	insert_last(vmm_used, malloc_node);
 	
-	return malloc_ptr;
+	return (u32int *) malloc_data->virt_addr;
 }
 
 void free(u32int *virt_addr)
@@ -146,14 +220,31 @@ void free(u32int *virt_addr)
 		return;
 	}
 	
-	list_node_type *goes_before = search_free_neighbor(used_node);
+	vmm_data_type *used_data = (vmm_data_type *) used_node->data;
 	
+	// move the region over to the free lists
 	remove(vmm_used, used_node);
 	
-	insert_before(vmm_free, goes_before, used_node);
+	used_data->free = TRUE;
+	tree_refresh(used_data);
+	free_class_insert(used_node);
 	
-	compact_all_free();
+	// if the region before it is free, and right up against it, merge them
+	vmm_data_type *prev_data = tree_prev(used_data);
 	
+	if ((prev_data != NULL) && (prev_data->free) && (prev_data->virt_addr + prev_data->size == used_data->virt_addr))
+	{
+		compact_after(prev_data->node);
+		used_data = prev_data;
+	}
+	
+	// if the region after it is free, and right up against it, merge them
+	vmm_data_type *next_data = tree_next(used_data);
+	
+	if ((next_data != NULL) && (next_data->free) && (used_data->virt_addr + used_data->size == next_data->virt_addr))
+	{
+		compact_after(used_data->node);
+	}
 }
 
 void vmm_print_node(list_node_type *node)
@@ -201,7 +292,30 @@ void vmm_print_list(list_type *list)
 
 void vmm_print_free()
 {
-	vmm_print_list(vmm_free);
+	// walk the tree in address order, and print the free regions
+	vmm_data_type *current = vmm_root;
+	
+	if (current == NULL)
+	{
+		put_str("\nEmpty list.\n");
+		return;
+	}
+	
+	while (current->left != NULL)
+	{
+		current = current->left;
+	}
+	
+	do
+	{
+		if (current->free)
+		{
+			vmm_print_node(current->node);
+		}
+		current = tree_next(current);
+	} while (current != NULL);
+	
+	put_str("\n");
 }
 
 void vmm_print_used()
@@ -209,187 +323,621 @@ void vmm_print_used()
 	vmm_print_list(vmm_used);
 }
 
+void vmm_node_stats(vmm_node_stats_type *stats)
+{
+	stats->nodes_created = vmm_nodes_created;
+	stats->nodes_unused = vmm_nodes_unused;
+	stats->arena_used = vmm_node_top - VMM_NODE_START;
+	stats->arena_mapped = vmm_node_mapped_end - VMM_NODE_START;
+	stats->arena_size = VMM_NODE_END - VMM_NODE_START;
+}
+
 list_node_type *split_free(list_node_type *node, u32int size)
 {
+	// the node has to be off the free lists. it keeps the first size bytes,
+	// and the rest of the region goes on a new node on the free lists.
 	vmm_data_type *node_data = node->data;
 	list_node_type *new_node = get_unused_node();
 	vmm_data_type *new_node_data = new_node->data;
 	new_node_data->virt_addr = node_data->virt_addr + size;
 	new_node_data->size = node_data->size - size;
+	new_node_data->free = TRUE;
 	node_data->size = size;
-	insert_after(vmm_free, node, new_node);
+	tree_refresh(node_data);
+	tree_insert(new_node_data);
+	free_class_insert(new_node);
 	return node;
 }
 
-list_node_type *search_free(u32int size, u32int above)
+list_node_type *search_free(u32int size, u32int align, u32int above)
 {
-	list_node_type *result = NULL;
-	list_node_type *candidate = vmm_free->first;
+	// the worst case is that lining the allocation up wastes align - 1 bytes
+	u32int needed = size + align - 1;
 	
-	do
+	if (needed < size)
 	{
+		return NULL;
+	}
+	
+	// every region in a class at least as big as what's needed will do
+	u32int fits_class = size_class(needed);
+	
+	if (needed != ((u32int) 1 << fits_class))
+	{
+		fits_class++;
+	}
+	
+	if ((above == 0) && (fits_class < VMM_FREE_CLASSES))
+	{
+		u32int classes = vmm_free_class_map & (0xFFFFFFFF << fits_class);
 		
-		vmm_data_type *node_data = candidate->data;
-		
-		if ((((node_data->virt_addr <= above) && (node_data->virt_addr + node_data->size > above)) || (node_data->virt_addr >= above)) && (node_data->size >= size))
+		if (classes != 0)
 		{
-			result = candidate;
-			break;
+			return vmm_free_classes[__builtin_ctz(classes)].first;
 		}
-		
-		candidate = candidate->next;
-	} while (candidate != NULL);
+	}
 	
+	// otherwise find the lowest region that'll hold it, skipping any part of the tree that's too small
+	vmm_data_type *result = tree_search_fit(vmm_root, size, align, above);
 	
-	return result;
+	if (result == NULL)
+	{
+		return NULL;
+	}
+	
+	return result->node;
 }
 
 list_node_type *get_unused_node()
 {
 	list_node_type *result = NULL;
 	
+	// the unused nodes are a stack, so the one that was released most recently gets used first
 	if (vmm_unused_nodes->first != NULL)
 	{
 		result = vmm_unused_nodes->first;
 		remove(vmm_unused_nodes, vmm_unused_nodes->first);
-	}
-	else if ((vmm_free->first == NULL) && (vmm_used->first == NULL))
-	{
-		u32int new_node_addr = (u32int) vmm_free + sizeof(list_type);
-		
-		u32int new_data_addr = new_node_addr + sizeof(list_node_type);
-		
-		result = (list_node_type *) new_node_addr;
-		
-		result->prev = NULL;
-		result->data = (u32int *) new_data_addr;
-		result->next = NULL;
-		
-		vmm_data_type *result_data = (vmm_data_type *) new_data_addr;
-		
-		result_data->virt_addr = NULL;
-		result_data->size = NULL;
+		vmm_nodes_unused--;
 	}
 	else
 	{
-		u32int highest_node_addr = (u32int) highest_node(vmm_free);
-		
-		if (((u32int) highest_node(vmm_used)) > highest_node_addr)
-		{
-			highest_node_addr = (u32int) highest_node(vmm_used);
-		}
+		// put a new node, and its data, on the top of the ones i've already made
+		u32int new_node_addr = vmm_node_top;
+		u32int new_data_addr = new_node_addr + sizeof(list_node_type);
 		
-		u32int new_node_addr = highest_node_addr + sizeof(list_type) + sizeof(list_node_type);
+		vmm_node_arena_grow(new_data_addr + sizeof(vmm_data_type));
 		
-		u32int new_data_addr = new_node_addr + sizeof(list_node_type);
+		vmm_node_top = new_data_addr + sizeof(vmm_data_type);
+		vmm_nodes_created++;
 		
 		result = (list_node_type *) new_node_addr;
-		
-		result->prev = NULL;
 		result->data = (u32int *) new_data_addr;
-		result->next = NULL;
-		
-		vmm_data_type *result_data = (vmm_data_type *) new_data_addr;
-		
-		result_data->virt_addr = NULL;
-		result_data->size = NULL;
 	}
 	
+	result->prev = NULL;
+	result->next = NULL;
+	
+	vmm_data_type *result_data = (vmm_data_type *) result->data;
+	
+	result_data->virt_addr = NULL;
+	result_data->size = NULL;
+	result_data->free = FALSE;
+	result_data->node = result;
+	result_data->left = NULL;
+	result_data->right = NULL;
+	result_data->parent = NULL;
+	result_data->height = 1;
+	result_data->max_free = 0;
+	
 	return result;
 }
 
 list_node_type *search_used(u32int *virt_addr)
 {
-	list_node_type *result = NULL;
-	list_node_type *candidate = vmm_used->first;
+	vmm_data_type *result = tree_find((u32int) virt_addr);
 	
-	do
+	if ((result == NULL) || (result->free))
 	{
-		vmm_data_type *candidate_data = candidate->data;
-		
-		if (candidate_data->virt_addr == (u32int) virt_addr)
+		return NULL;
+	}
+	
+	return result->node;
+}
+
+vmm_data_type *vmm_region_containing(u32int virt_addr)
+{
+	// find the region with the highest address that starts at or below the address
+	vmm_data_type *current = vmm_root;
+	vmm_data_type *result = NULL;
+	
+	while (current != NULL)
+	{
+		if (current->virt_addr <= virt_addr)
 		{
-			result = candidate;
-			break;
+			result = current;
+			current = current->right;
 		}
-		
-		candidate = candidate->next;
-	} while (candidate != NULL);
+		else
+		{
+			current = current->left;
+		}
+	}
+	
+	// then make sure the address is actually inside it, and that it's been handed out
+	if ((result == NULL) || (result->free) || (virt_addr - result->virt_addr >= result->size))
+	{
+		return NULL;
+	}
 	
 	return result;
 }
 
-list_node_type *search_free_neighbor(list_node_type *node)
+void add_free(u32int virt_addr, u32int size)
 {
-	list_node_type *result = NULL;
-	list_node_type *candidate = vmm_free->first;
+	// make a node for the region, and put it on the tree and the free lists
+	list_node_type *new_node = get_unused_node();
+	vmm_data_type *new_data = (vmm_data_type *) new_node->data;
 	
-	do
+	new_data->virt_addr = virt_addr;
+	new_data->size = size;
+	new_data->free = TRUE;
+	
+	tree_insert(new_data);
+	free_class_insert(new_node);
+	
+	// merge it with the free regions on either side of it
+	vmm_data_type *prev_data = tree_prev(new_data);
+	
+	if ((prev_data != NULL) && (prev_data->free) && (prev_data->virt_addr + prev_data->size == virt_addr))
+	{
+		compact_after(prev_data->node);
+		new_data = prev_data;
+	}
+	
+	vmm_data_type *next_data = tree_next(new_data);
+	
+	if ((next_data != NULL) && (next_data->free) && (new_data->virt_addr + new_data->size == next_data->virt_addr))
+	{
+		compact_after(new_data->node);
+	}
+}
+
+void compact_after(list_node_type *node)
+{
+	// merges the free region after this one in to it
+	vmm_data_type *node_data = (vmm_data_type *) node->data;
+	vmm_data_type *next_node_data = tree_next(node_data);
+	list_node_type *next_node = next_node_data->node;
+	
+	// take both of them off the free lists, since they're changing
+	free_class_remove(node);
+	free_class_remove(next_node);
+	
+	tree_remove(next_node_data);
+	
+	node_data->size = node_data->size + next_node_data->size;
+	tree_refresh(node_data);
+	
+	free_class_insert(node);
+	
+	insert_first(vmm_unused_nodes, next_node);
+	vmm_nodes_unused++;
+}
+
+static u32int size_class(u32int size)
+{
+	// the class is the highest bit set on the size
+	return 31 - __builtin_clz(size);
+}
+
+static void free_class_insert(list_node_type *node)
+{
+	u32int class = size_class(((vmm_data_type *) node->data)->size);
+	insert_first(&vmm_free_classes[class], node);
+	vmm_free_class_map |= (u32int) 1 << class;
+}
+
+static void free_class_remove(list_node_type *node)
+{
+	u32int class = size_class(((vmm_data_type *) node->data)->size);
+	remove(&vmm_free_classes[class], node);
+	
+	if (vmm_free_classes[class].first == NULL)
+	{
+		vmm_free_class_map &= ~((u32int) 1 << class);
+	}
+}
+
+// figures out where an allocation would go in a free region, or returns 0xFFFFFFFF if it won't fit
+static u32int fit_addr(vmm_data_type *data, u32int size, u32int align, u32int above)
+{
+	u32int start_addr = data->virt_addr;
+	u32int end_addr = data->virt_addr + data->size;
+	
+	if (start_addr < above)
+	{
+		start_addr = above;
+	}
+	
+	if (start_addr >= end_addr)
+	{
+		return 0xFFFFFFFF;
+	}
+	
+	// line the start up
+	u32int misalignment = start_addr % align;
+	
+	if (misalignment != 0)
 	{
-		vmm_data_type *candidate_data = candidate->data;
-		vmm_data_type *node_data = node->data;
+		if (align - misalignment >= end_addr - start_addr)
+		{
+			return 0xFFFFFFFF;
+		}
+		start_addr += align - misalignment;
+	}
+	
+	if (end_addr - start_addr < size)
+	{
+		return 0xFFFFFFFF;
+	}
+	
+	return start_addr;
+}
+
+// makes sure there are frames behind the node arena up to the address given
+static void vmm_node_arena_grow(u32int end_addr)
+{
+	if (end_addr > VMM_NODE_END)
+	{
+		put_str("\nThe virtual memory manager has run out of space for its nodes.");
+		put_str("\nHalting.");
+		for (;;) {}
+	}
+	
+	while (vmm_node_mapped_end < end_addr)
+	{
+		u32int phys_addr = alloc_frame();
 		
-		if (candidate_data->virt_addr > node_data->virt_addr)
+		if (phys_addr == 0xFFFFFFFF)
 		{
-			result = candidate;
-			break;
+			put_str("\nThe virtual memory manager is unable to get a frame for its nodes.");
+			put_str("\nHalting.");
+			for (;;) {}
 		}
 		
-		candidate = candidate->next;
-	} while (candidate != NULL);
+		map_page(vmm_node_mapped_end, phys_addr, PAGE_KERNEL);
+		vmm_node_mapped_end += 0x1000;
+	}
+}
+
+// adds free space to the run, or puts the run on the free lists and starts a new one if it isn't next to it
+static void vmm_extend_run(u32int *run_start, u32int *run_size, u32int virt_addr, u32int size)
+{
+	if ((*run_size != 0) && (*run_start + *run_size == virt_addr))
+	{
+		*run_size += size;
+		return;
+	}
 	
-	return result;
+	if (*run_size != 0)
+	{
+		add_free(*run_start, *run_size);
+	}
+	
+	*run_start = virt_addr;
+	*run_size = size;
 }
 
-list_node_type *search_adjacent_free()
+/*
+ * The tree is an AVL tree sorted by virtual address. Every node knows
+ * its parent, so finding the regions on either side of one is just a
+ * walk up or down the tree, and rebalancing walks from wherever the
+ * tree changed back up to the root.
+ */
+
+static u32int tree_height(vmm_data_type *data)
 {
-	list_node_type *result = NULL;
-	list_node_type *candidate = vmm_free->first;
+	return (data == NULL) ? 0 : data->height;
+}
+
+static void tree_update(vmm_data_type *data)
+{
+	u32int left_height = tree_height(data->left);
+	u32int right_height = tree_height(data->right);
 	
-	do
+	data->height = ((left_height > right_height) ? left_height : right_height) + 1;
+	
+	// the biggest free region under the node is either the node or under one of its children
+	data->max_free = data->free ? data->size : 0;
+	
+	if ((data->left != NULL) && (data->left->max_free > data->max_free))
+	{
+		data->max_free = data->left->max_free;
+	}
+	
+	if ((data->right != NULL) && (data->right->max_free > data->max_free))
+	{
+		data->max_free = data->right->max_free;
+	}
+}
+
+// after a region changes size or is marked free or used, the nodes above it need to know
+static void tree_refresh(vmm_data_type *data)
+{
+	while (data != NULL)
 	{
+		tree_update(data);
+		data = data->parent;
+	}
+}
+
+static void tree_replace_child(vmm_data_type *parent, vmm_data_type *old_child, vmm_data_type *new_child)
+{
+	if (parent == NULL)
+	{
+		vmm_root = new_child;
+	}
+	else if (parent->left == old_child)
+	{
+		parent->left = new_child;
+	}
+	else
+	{
+		parent->right = new_child;
+	}
+	
+	if (new_child != NULL)
+	{
+		new_child->parent = parent;
+	}
+}
+
+static vmm_data_type *tree_rotate_left(vmm_data_type *data)
+{
+	vmm_data_type *right = data->right;
+	
+	data->right = right->left;
+	if (right->left != NULL)
+	{
+		right->left->parent = data;
+	}
+	
+	tree_replace_child(data->parent, data, right);
+	
+	right->left = data;
+	data->parent = right;
+	
+	tree_update(data);
+	tree_update(right);
+	
+	return right;
+}
+
+static vmm_data_type *tree_rotate_right(vmm_data_type *data)
+{
+	vmm_data_type *left = data->left;
+	
+	data->left = left->right;
+	if (left->right != NULL)
+	{
+		left->right->parent = data;
+	}
+	
+	tree_replace_child(data->parent, data, left);
+	
+	left->right = data;
+	data->parent = left;
+	
+	tree_update(data);
+	tree_update(left);
+	
+	return left;
+}
+
+static void tree_rebalance(vmm_data_type *data)
+{
+	// walk up to the root, fixing the heights, and rotating anything that's lopsided
+	while (data != NULL)
+	{
+		tree_update(data);
+		
+		s32int balance = (s32int) tree_height(data->left) - (s32int) tree_height(data->right);
 		
-		if (candidate->next != NULL)
+		if (balance > 1)
 		{
-			vmm_data_type *candidate_data = (vmm_data_type *) candidate->data;
-			vmm_data_type *candidate_next_data = (vmm_data_type *) candidate->next->data;
-			
-			if ((candidate_data->virt_addr + candidate_data->size) == candidate_next_data->virt_addr)
+			if (tree_height(data->left->left) < tree_height(data->left->right))
 			{
-				result = candidate;
-				break;
+				tree_rotate_left(data->left);
 			}
+			data = tree_rotate_right(data);
+		}
+		else if (balance < -1)
+		{
+			if (tree_height(data->right->right) < tree_height(data->right->left))
+			{
+				tree_rotate_right(data->right);
+			}
+			data = tree_rotate_left(data);
 		}
 		
-		candidate = candidate->next;
-	} while (candidate != NULL);
+		data = data->parent;
+	}
+}
+
+static void tree_insert(vmm_data_type *data)
+{
+	data->left = NULL;
+	data->right = NULL;
+	data->parent = NULL;
+	data->height = 1;
+	data->max_free = data->free ? data->size : 0;
 	
-	return result;
+	if (vmm_root == NULL)
+	{
+		vmm_root = data;
+		return;
+	}
+	
+	// find where it goes
+	vmm_data_type *parent = vmm_root;
+	
+	for (;;)
+	{
+		if (data->virt_addr < parent->virt_addr)
+		{
+			if (parent->left == NULL)
+			{
+				parent->left = data;
+				break;
+			}
+			parent = parent->left;
+		}
+		else
+		{
+			if (parent->right == NULL)
+			{
+				parent->right = data;
+				break;
+			}
+			parent = parent->right;
+		}
+	}
+	
+	data->parent = parent;
+	tree_rebalance(parent);
 }
 
-void compact_after(list_node_type *node)
+static void tree_remove(vmm_data_type *data)
 {
-	vmm_data_type *node_data = (vmm_data_type *) node->data;
+	vmm_data_type *rebalance_from;
+	
+	if ((data->left == NULL) || (data->right == NULL))
+	{
+		// with one child (or none), the child just takes its place
+		vmm_data_type *child = (data->left != NULL) ? data->left : data->right;
+		rebalance_from = data->parent;
+		tree_replace_child(data->parent, data, child);
+	}
+	else
+	{
+		// with two children, the next node in order takes its place
+		vmm_data_type *successor = data->right;
+		
+		while (successor->left != NULL)
+		{
+			successor = successor->left;
+		}
+		
+		if (successor->parent == data)
+		{
+			rebalance_from = successor;
+		}
+		else
+		{
+			rebalance_from = successor->parent;
+			
+			// take the successor out of where it is, and give it the right side
+			tree_replace_child(successor->parent, successor, successor->right);
+			successor->right = data->right;
+			successor->right->parent = successor;
+		}
+		
+		successor->left = data->left;
+		successor->left->parent = successor;
+		tree_replace_child(data->parent, data, successor);
+	}
 	
-	list_node_type *next_node = node->next;
-	vmm_data_type *next_node_data = (vmm_data_type *) next_node->data;
+	data->left = NULL;
+	data->right = NULL;
+	data->parent = NULL;
 	
-	u32int new_size = node_data->size + next_node_data->size;
+	tree_rebalance(rebalance_from);
+}
+
+static vmm_data_type *tree_find(u32int virt_addr)
+{
+	vmm_data_type *current = vmm_root;
 	
-	node_data->size = new_size;
+	while (current != NULL)
+	{
+		if (virt_addr == current->virt_addr)
+		{
+			return current;
+		}
+		
+		current = (virt_addr < current->virt_addr) ? current->left : current->right;
+	}
 	
-	remove(vmm_free, next_node);
+	return NULL;
+}
+
+static vmm_data_type *tree_next(vmm_data_type *data)
+{
+	// if there's anything to the right, it's the leftmost thing over there
+	if (data->right != NULL)
+	{
+		data = data->right;
+		while (data->left != NULL)
+		{
+			data = data->left;
+		}
+		return data;
+	}
 	
-	insert_last(vmm_unused_nodes, next_node);
+	// otherwise it's the first parent i reach from its left side
+	while ((data->parent != NULL) && (data == data->parent->right))
+	{
+		data = data->parent;
+	}
+	return data->parent;
+}
+
+static vmm_data_type *tree_prev(vmm_data_type *data)
+{
+	// if there's anything to the left, it's the rightmost thing over there
+	if (data->left != NULL)
+	{
+		data = data->left;
+		while (data->right != NULL)
+		{
+			data = data->right;
+		}
+		return data;
+	}
+	
+	// otherwise it's the first parent i reach from its right side
+	while ((data->parent != NULL) && (data == data->parent->left))
+	{
+		data = data->parent;
+	}
+	return data->parent;
 }
 
-void compact_all_free()
+// finds the free region with the lowest address that can hold an allocation
+static vmm_data_type *tree_search_fit(vmm_data_type *data, u32int size, u32int align, u32int above)
 {
-	list_node_type *node = search_adjacent_free();
+	// nothing under here is big enough
+	if ((data == NULL) || (data->max_free < size))
+	{
+		return NULL;
+	}
+	
+	// everything to the left ends before this region starts, so if this one
+	// starts below the address it has to be above, none of them will do
+	if (data->virt_addr > above)
+	{
+		vmm_data_type *result = tree_search_fit(data->left, size, align, above);
+		
+		if (result != NULL)
+		{
+			return result;
+		}
+	}
 	
-	while (node != NULL)
+	if ((data->free) && (fit_addr(data, size, align, above) != 0xFFFFFFFF))
 	{
-		compact_after(node);
-		node = search_adjacent_free();
+		return data;
 	}
+	
+	return tree_search_fit(data->right, size, align, above);
 }
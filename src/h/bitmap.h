@@ -3,10 +3,17 @@
 
 #include <system.h>
 
+// the bitmap is worked on 32 bits at a time. full and empty are an optional
+// summary with one bit for each 32-bit word of the bitmap. a bit on full is
+// set when every bit in that word is set, and a bit on empty is set when no
+// bits in that word are set. if they're NULL the bitmap is just scanned a
+// word at a time.
 typedef struct bitmap_struct
 {
 	u8int *addr;
 	u32int bytes;
+	u32int *full;
+	u32int *empty;
 } bitmap_type;
 
 // a bitmap can only have a theoretical maximum size of 536,870,912 bytes (512MB, 0.5GB), or 4,294,967,296 bits
@@ -21,4 +28,12 @@ void set_all_bits(bitmap_type *bitmap);
 boolean any_bit_clear(bitmap_type *bitmap);
 boolean any_bit_set(bitmap_type *bitmap);
 
+// the next_*_from functions return 0xFFFFFFFF when there's nothing left to find
+u32int next_set_from(bitmap_type *bitmap, u32int bit);
+u32int next_clear_from(bitmap_type *bitmap, u32int bit);
+void set_range(bitmap_type *bitmap, u32int bit, u32int count);
+void clear_range(bitmap_type *bitmap, u32int bit, u32int count);
+u32int bitmap_summary_size(u32int bytes);
+void attach_summary(bitmap_type *bitmap, u32int *full, u32int *empty);
+
 #endif
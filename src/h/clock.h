@@ -0,0 +1,28 @@
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+#include <system.h>
+
+// how long the TSC gets timed against PIT channel 2 for, about 10 ms
+#define CLOCK_CALIBRATE_COUNTS 11932
+
+// fewer TSC cycles than this while calibrating means the TSC can't be trusted (it's under 10 MHz)
+#define CLOCK_TSC_MIN_CYCLES 100000
+
+// nanoseconds are worked out as (count * mult) >> shift. the TSC's mult is worked out at boot,
+// and the PIT's is a constant. the shifts keep each mult as precise as it can be and still fit in 32 bits.
+#define CLOCK_TSC_SHIFT 24
+#define CLOCK_PIT_SHIFT 22
+#define CLOCK_PIT_MULT ((u32int) ((1000000000ULL << CLOCK_PIT_SHIFT) / PIT_FREQUENCY))
+
+// where the time comes from
+#define CLOCK_SOURCE_PIT 0
+#define CLOCK_SOURCE_TSC 1
+
+void clock_initialize();
+u64int clock_ns();
+u32int clock_source();
+u32int clock_tsc_khz();
+u32int clock_div(u64int dividend, u32int divisor, u32int *remainder);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __CPU_H
+#define __CPU_H
+
+#include <system.h>
+
+// feature bits cpuid leaf 1 puts on edx
+#define CPU_FEATURE_PSE (1 << 3)
+#define CPU_FEATURE_TSC (1 << 4)
+#define CPU_FEATURE_APIC (1 << 9)
+#define CPU_FEATURE_PGE (1 << 13)
+
+// the bit cpuid leaf 0x80000007 puts on edx if the TSC keeps the same rate through power states and halts
+#define CPU_INVARIANT_TSC (1 << 8)
+
+void cpu_initialize();
+boolean cpu_has_cpuid();
+void cpuid(u32int leaf, u32int *eax, u32int *ebx, u32int *ecx, u32int *edx);
+boolean cpu_has_feature(u32int feature);
+u64int cpu_read_tsc();
+boolean cpu_has_invariant_tsc();
+
+#endif
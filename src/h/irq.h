@@ -3,7 +3,7 @@
 
 #include <system.h>
 
-void irq_handler(registers regs);
+void irq_handler(registers *regs);
 
 extern void irq0();
 extern void irq1();
@@ -6,8 +6,12 @@
 // an array(?)[a portion of memory, at least] containing pointers to the ISRs
 isr interrupt_handler[256];
 
+// how many times each vector has gone off
+extern u32int interrupt_count[256];
+
 void register_interrupt_handler(u8int n, isr handler);
-void isr_handler(registers regs);
+void isr_handler(registers *regs);
+void interrupt_print_counts();
 
 #define IRQ0 32
 #define IRQ1 33
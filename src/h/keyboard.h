@@ -6,9 +6,10 @@
 #define KEYBOARD_BUFFER_SIZE 4096
 
 void keyboard_flush();
+void keyboard_wait();
 void keyboard_set_handler(void (*callback)(u8int *buf, u16int size));
 void keyboard_initialize();
-void keyboard_interrupt_handler(__attribute__ ((unused)) registers regs);
+void keyboard_interrupt_handler(__attribute__ ((unused)) registers *regs);
 
 #define ESC    27
 #define BACKSPACE '\b'
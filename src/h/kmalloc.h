@@ -0,0 +1,31 @@
+#ifndef __KMALLOC_H
+#define __KMALLOC_H
+
+#include <system.h>
+
+// small allocations come off a slab cache for each power of two from 8 bytes up to 1 KB.
+// anything bigger gets whole pages of its own, since a 2 KB class would only fit one object
+// next to the slab header and waste the rest of the page.
+#define KMALLOC_MIN_SHIFT 3
+#define KMALLOC_CLASSES 8
+#define KMALLOC_MAX_SMALL (1 << (KMALLOC_MIN_SHIFT + KMALLOC_CLASSES - 1))
+
+typedef struct kmalloc_stats_struct
+{
+	u32int hits[KMALLOC_CLASSES];
+	u32int misses[KMALLOC_CLASSES];
+	u32int span_allocs;
+	u32int span_pages;
+} kmalloc_stats_type;
+
+// none of the heap (kmalloc, the slab caches, or the vmm lists under them) takes a lock, and the timer can
+// switch threads in the middle of any of it. that's fine while only one thread at a time allocates, but a
+// second one using kmalloc would need a lock around all of it first. it's also why nothing compacts the heap
+// in the background.
+void kmalloc_initialize();
+u32int *kmalloc(u32int size);
+void kfree(u32int *ptr);
+u32int *krealloc(u32int *ptr, u32int size);
+void kmalloc_print_stats();
+
+#endif
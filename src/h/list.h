@@ -1,8 +1,6 @@
 #ifndef __LIST_H
 #define __LIST_H
 
-#include <system.h>
-
 typedef struct list_node_struct
 {
 	struct list_node_struct *prev;
@@ -16,6 +14,9 @@ typedef struct list_struct
 	struct list_node_struct *last;
 } list_type;
 
+// the list types go before system.h, because some of the headers it pulls in keep lists inside their own structures
+#include <system.h>
+
 void insert_after(list_type *list, list_node_type *node, list_node_type *new_node);
 void insert_before(list_type *list, list_node_type *node, list_node_type *new_node);
 void insert_first(list_type *list, list_node_type *new_node);
@@ -3,12 +3,46 @@
 
 #include <system.h>
 
+// bits on page directory and page table entries
+#define PAGE_PRESENT 0x1
+#define PAGE_WRITE 0x2
+#define PAGE_USER 0x4
+#define PAGE_LARGE 0x80
+#define PAGE_GLOBAL 0x100
+
+// one of the bits the processor leaves for me. it marks a page that's shared read only
+// between address spaces, and gets copied the first time somebody writes to it.
+#define PAGE_COW 0x200
+
+// the kernel's mappings are the same in every address space, so they're global and survive CR3 being changed
+#define PAGE_KERNEL (PAGE_PRESENT | PAGE_WRITE | PAGE_GLOBAL)
+
+// physical memory from 0 up to this much is mapped at 0xC0000000, with 4 MB pages wherever it can be
+#define PAGING_DIRECT_MAP_MAX 0x10000000
+
+// the temporary mapping window is the 4 MB under the recursive mappings, and it has its own page table
+#define KMAP_WINDOW_START 0xFF800000
+#define KMAP_WINDOW_TABLE 0xFFFFE000
+#define KMAP_SLOTS 32
+
+// a fault inside a malloc'd region maps this many pages to start with, and up
+// to the maximum as long as the faults keep coming one after the other
+#define PAGING_FAULT_AROUND_MIN 4
+#define PAGING_FAULT_AROUND_MAX 16
+
+// flushing more pages than this at once reloads CR3 instead of using invlpg on each one
+#define PAGING_INVLPG_MAX 32
+
+// virt_to_phys remembers this many translations for the current page directory
+#define PAGING_XLATE_ENTRIES 64
+
 // data structures and type definitions
 
 typedef struct page_table_struct
 {
 	u32int *virt_addr;
 	u32int phys_addr;
+	u32int live;	// how many entries on the table are present
 } page_table_type;
 
 typedef struct page_directory_struct
@@ -18,6 +52,20 @@ typedef struct page_directory_struct
 	page_table_type tables[1024];
 } page_directory_type;
 
+// one piece of physically contiguous memory behind a virtual buffer
+typedef struct phys_extent_struct
+{
+	u32int phys_addr;
+	u32int size;
+} phys_extent_type;
+
+// a translation virt_to_phys has already worked out. an empty one has 0xFFFFFFFF for virt_page.
+typedef struct paging_xlate_struct
+{
+	u32int virt_page;
+	u32int phys_page;
+} paging_xlate_type;
+
 // functions defined in the assembly file
 extern u32int read_cr0();
 extern void write_cr0(u32int);
@@ -33,13 +81,29 @@ extern void write_cr4(u32int);
 
 // function included in the c file
 void paging_initialize();
-void page_fault_interrupt_handler(registers regs);
+void page_fault_interrupt_handler(registers *regs);
 void invlpg(u32int addr);
 u32int virt_to_phys(page_directory_type *page_directory, u32int virt_addr);
-void map_page(u32int virt_addr, u32int phys_addr);
+u32int virt_to_phys_range(page_directory_type *page_directory, u32int virt_addr, u32int size, phys_extent_type *extents, u32int max_extents);
+void paging_xlate_flush();
+void map_page(u32int virt_addr, u32int phys_addr, u32int flags);
 void unmap_page(u32int virt_addr);
+void map_range(u32int virt_addr, u32int phys_addr, u32int count, u32int flags);
+void unmap_range(u32int virt_addr, u32int count);
+void map_large_range(u32int virt_addr, u32int phys_addr, u32int size, u32int flags);
+void paging_map_direct();
+u32int *kmap_temp(u32int phys_addr);
+void kunmap_temp(u32int *virt_addr);
+void zero_frame(u32int phys_addr);
+void flush_range(u32int virt_addr, u32int count);
+void flush_all();
+u32int *get_page_table(u32int page_dir_index, u32int phys_addr, u32int count);
+void release_page_table(u32int page_dir_index);
 void change_page_directory(page_directory_type *page_directory);
 u32int get_table_attribs(u32int page_dir_index);
+page_directory_type *clone_address_space();
+boolean copy_on_write(u32int virt_addr);
+boolean sync_kernel_table(u32int page_dir_index);
 void copy_page_directory(page_directory_type *source, page_directory_type *dest);
 void copy_page_table(page_table_type *source, page_table_type *dest);
 
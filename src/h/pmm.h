@@ -3,8 +3,51 @@
 
 #include <system.h>
 
+// the buddy allocator hands out blocks of 2^order frames, from 4 KB (order 0) to 4 MB (order 10)
+#define PMM_MAX_ORDER 10
+#define PMM_CHUNK_FRAMES (1 << PMM_MAX_ORDER)
+#define PMM_CHUNK_NODES (PMM_CHUNK_FRAMES * 2)
+
+// how many frames get cleared ahead of time while the kernel has nothing else to do
+#define PMM_ZERO_POOL_SIZE 64
+
+// what a frame is being used for
+#define PMM_PAGE_TABLE 0x1
+#define PMM_PAGE_SLAB 0x2
+#define PMM_PAGE_ZEROED 0x4
+
+// everything i know about one frame of physical memory
+typedef struct page_struct
+{
+	u16int refcount;
+	u8int flags;
+	u8int order;
+	void *owner;
+} page_type;
+
+typedef struct pmm_stats_struct
+{
+	u32int total_frames;
+	u32int free_frames;
+	u32int reserved_frames;
+	u32int largest_free_run;
+	u32int zeroed_frames;
+} pmm_stats_type;
+
 void pmm_initialize(struct multiboot *mboot_ptr);
 u32int alloc_frame();
 void free_frame(u32int addr);
+u32int alloc_frames(u32int order);
+void free_frames(u32int addr, u32int order);
+void pmm_stats(pmm_stats_type *stats);
+u32int alloc_zeroed_frame();
+boolean pmm_zero_idle();
+void pmm_pages_initialize();
+page_type *frame_to_page(u32int addr);
+u32int page_to_frame(page_type *page);
+void frame_set_owner(u32int addr, u8int flags, void *owner);
+void frame_ref(u32int addr);
+u32int frame_unref(u32int addr);
+u32int frame_refcount(u32int addr);
 
 #endif
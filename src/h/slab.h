@@ -0,0 +1,38 @@
+#ifndef __SLAB_H
+#define __SLAB_H
+
+#include <system.h>
+#include <list.h>
+
+// every slab is one page, with its header at the start of the page and the objects after it
+#define KMEM_SLAB_SIZE 0x1000
+
+typedef struct kmem_cache_struct
+{
+	u32int object_size;
+	u32int align;
+	u32int first_object;
+	u32int objects_per_slab;
+	list_type partial;
+	list_type full;
+	list_type empty;
+	u32int slabs;
+	u32int objects_in_use;
+} kmem_cache_type;
+
+typedef struct kmem_slab_struct
+{
+	list_node_type node;
+	kmem_cache_type *cache;
+	u32int in_use;
+	u32int *free_objects;
+} kmem_slab_type;
+
+void kmem_initialize();
+kmem_cache_type *kmem_cache_create(u32int size, u32int align);
+u32int *kmem_cache_alloc(kmem_cache_type *cache);
+void kmem_cache_free(kmem_cache_type *cache, u32int *object);
+void kmem_print_cache(kmem_cache_type *cache);
+void kmem_cache_tag_slabs(kmem_cache_type *cache);
+
+#endif
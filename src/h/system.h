@@ -5,6 +5,8 @@
 #define NULL 0
 #endif
 
+typedef unsigned long long u64int;
+typedef          long long s64int;
 typedef unsigned int   u32int;
 typedef          int   s32int;
 typedef unsigned short u16int;
@@ -27,20 +29,36 @@ typedef struct registers_struct
 //typedef struct registers_struct registers;
 
 // define a datatype for a function that has one paramater of type registers and returns a *isr (function pointer)[i think]
-typedef void (*isr)(registers);
+// the registers are left where the stub pushed them, and the handler gets a pointer to them
+typedef void (*isr)(registers *);
 
 #define enable_interrupts() asm volatile("sti")
 #define disable_interrupts() asm volatile("cli")
 
+// turns interrupts off, and hands back the flags from before so they can be put back the way they were
+static inline u32int interrupts_save()
+{
+	u32int eflags;
+	asm volatile ("pushf\n\tpop %0\n\tcli" : "=r" (eflags) : : "memory");
+	return eflags;
+}
+
+static inline void interrupts_restore(u32int eflags)
+{
+	asm volatile ("push %0\n\tpopf" : : "r" (eflags) : "memory", "cc");
+}
+
 #include <multiboot.h>
 #include <string.h>	// goes up top because it defines a datatype that can be used anywhere in the system.
 #include <port.h>
+#include <cpu.h>
 #include <memory.h>
 #include <gdt.h>
 #include <idt.h>
 #include <isr.h>
 #include <irq.h>
 #include <timer.h>
+#include <clock.h>
 #include <keyboard.h>
 #include <vga.h>
 #include <list.h>
@@ -48,10 +66,13 @@ typedef void (*isr)(registers);
 #include <pmm.h>
 #include <paging.h>
 #include <vmm.h>
+#include <slab.h>
+#include <kmalloc.h>
 #include <task.h>
 #include <initrd.h>
 
 void terminal();
+void terminal_thread();
 void kernel_keyboard_handler(u8int *buf, u16int size);
 void kernel_vga_handler(u8int *buf, u16int size);
 
@@ -3,6 +3,57 @@
 
 #include <system.h>
 
+// how big each thread's kernel stack is
+#define TASK_STACK_SIZE 0x4000
 
+// there's a run queue for each priority, and 0 is the most important. there are as many
+// as there are bits in a word, so one word says which queues have anything on them.
+#define TASK_PRIORITIES 32
+#define TASK_PRIORITY_DEFAULT 16
+
+// a thread that keeps blocking before its turn is up moves up a priority each time, and one that keeps
+// using its whole turn moves down, but neither goes further than this from where it started
+#define TASK_BOOST_MAX 4
+
+// how many timer ticks a turn lasts. the most important threads get the longest turns.
+#define TASK_SLICE_MIN 1
+#define task_time_slice(priority) (TASK_SLICE_MIN + ((TASK_PRIORITIES - 1 - (priority)) >> 3))
+
+// what a thread is up to
+#define TASK_READY 0
+#define TASK_RUNNING 1
+#define TASK_BLOCKED 2
+#define TASK_DEAD 3
+
+// a thread's control block. node puts it on the ready list, or on whatever list it's waiting on.
+typedef struct task_struct
+{
+	u32int esp;
+	u32int id;
+	u32int state;
+	u32int priority;	// the priority it was created with
+	u32int dynamic;	// the priority it's actually run at, after boosts
+	u32int ticks_left;
+	u32int *stack;
+	void (*entry)();
+	char *name;
+	list_node_type node;
+	struct task_struct *all_next;
+} task_type;
+
+// function defined in the assembly file
+extern void switch_task(u32int *old_esp, u32int new_esp);
+
+// functions included in the c file
+void task_initialize();
+task_type *task_create(char *name, void (*entry)(), u32int priority);
+void task_exit();
+void task_yield();
+void task_block(list_type *wait_list);
+void task_wake(list_type *wait_list);
+void task_tick();
+void task_preempt();
+void task_halt();
+void task_print_list();
 
 #endif
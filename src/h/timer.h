@@ -3,8 +3,22 @@
 
 #include <system.h>
 
+// how many times a second the PIT counts down
+#define PIT_FREQUENCY 1193182
+
+// what the PIT counts down from while the idle thread is asleep. that's as far as it can count,
+// about 55 ms.
+#define TIMER_IDLE_COUNTS 0x10000
+
+// roughly how many counts go by between reading the PIT and it starting over from a new count,
+// for the handful of port accesses that takes
+#define TIMER_REPROGRAM_COUNTS 8
+
 void timer_initialize(u32int freq);
-void timer_interrupt_handler(__attribute__ ((unused)) registers regs);
+void timer_interrupt_handler(__attribute__ ((unused)) registers *regs);
+void timer_stop_tick();
+void timer_start_tick();
+u64int timer_read_counts();
 u32int get_tick();
 
 #endif
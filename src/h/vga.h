@@ -32,6 +32,8 @@ void put_hex(u32int n);
 void clear_screen();
 void vga_set_handler(void (*callback)(u8int *buf, u16int size));
 void vga_flush();
+void vga_wait();
+void vga_thread();
 void vga_buffer_put_char(char c);
 void vga_buffer_put_str(char *str);
 void clear_line();
@@ -6,12 +6,41 @@
 typedef struct list_struct list_type;
 typedef struct list_node_struct list_node_type;
 
+// the virtual memory manager's own nodes live in this 4 MB, and it's never handed out.
+// it's up at the top, out of the way of the direct map of physical memory at 0xC0000000.
+#define VMM_NODE_START 0xFF000000
+#define VMM_NODE_END 0xFF400000
+
+// the kernel's half of the address space starts here. the kernel's own allocations stay above it.
+#define VMM_KERNEL_START 0xC0000000
+
+// free regions are kept on a list for each power of two they fall between
+#define VMM_FREE_CLASSES 32
+
+// every region, free or used, is also on a tree sorted by virtual address.
+// max_free is the size of the biggest free region under each node.
 typedef struct vmm_data_struct
 {
 	u32int virt_addr;
 	u32int size;
+	boolean free;
+	list_node_type *node;
+	struct vmm_data_struct *left;
+	struct vmm_data_struct *right;
+	struct vmm_data_struct *parent;
+	u32int height;
+	u32int max_free;
 } vmm_data_type;
 
+typedef struct vmm_node_stats_struct
+{
+	u32int nodes_created;
+	u32int nodes_unused;
+	u32int arena_used;
+	u32int arena_mapped;
+	u32int arena_size;
+} vmm_node_stats_type;
+
 void vmm_initialize();
 u32int *malloc(u32int size);
 u32int *malloc_align(u32int size, u32int align);
@@ -21,14 +50,14 @@ void vmm_print_node(list_node_type *node);
 void vmm_print_list(list_type *list);
 void vmm_print_free();
 void vmm_print_used();
+void vmm_node_stats(vmm_node_stats_type *stats);
 list_node_type *split_free(list_node_type *node, u32int size);
-list_node_type *search_free(u32int size, u32int above);
+list_node_type *search_free(u32int size, u32int align, u32int above);
 list_node_type *get_unused_node();
 
 list_node_type *search_used(u32int *virt_addr);
-list_node_type *search_free_neighbor(list_node_type *node);
-list_node_type *search_adjacent_free();
+vmm_data_type *vmm_region_containing(u32int virt_addr);
+void add_free(u32int virt_addr, u32int size);
 void compact_after(list_node_type *node);
-void compact_all_free();
 
 #endif